@@ -0,0 +1,109 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Atomic operations, using LL/SC as in spinlock_data_testandset.
+ */
+
+void *atomic_swapptr(void *volatile *p, void *val);
+bool atomic_casptr(void *volatile *p, void *old, void *val);
+unsigned atomic_fetchadd(volatile unsigned *p, unsigned n);
+void atomic_membar(void);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+void *
+atomic_swapptr(void *volatile *p, void *val)
+{
+	void *x;
+	uintptr_t y;
+
+	do {
+		/* After the SC, Y is 1 if the store succeeded. */
+		y = (uintptr_t)val;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (p) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+bool
+atomic_casptr(void *volatile *p, void *old, void *val)
+{
+	void *x;
+	uintptr_t y;
+
+	while (1) {
+		/*
+		 * Load *P into X; if it's OLD, try to store VAL. Y
+		 * ends up 1 if the store happened, and 0 if it
+		 * failed or wasn't tried. (The move in the branch
+		 * delay slot runs either way.)
+		 */
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set noreorder;"	/* we fill the delay slot */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%3);"		/*   x = *p */
+			"bne %0, %2, 1f;"	/*   if (x != old) goto 1 */
+			" move %1, $0;"		/*   y = 0 */
+			"move %1, %4;"		/*   y = val */
+			"sc %1, 0(%3);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (old), "r" (p), "r" (val)
+			: "memory");
+		if (x != old) {
+			return false;
+		}
+		if (y != 0) {
+			return true;
+		}
+	}
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_fetchadd(volatile unsigned *p, unsigned n)
+{
+	unsigned x, y;
+
+	do {
+		/* After the SC, Y is 1 if the store succeeded. */
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + n */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (n) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+void
+atomic_membar(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/* order earlier loads/stores */
+		".set pop"		/* restore assembler mode */
+		::: "memory");
+}
+
+
+#endif /* _MIPS_ATOMIC_H_ */
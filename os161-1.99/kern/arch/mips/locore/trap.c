@@ -39,6 +39,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <workq.h>
 
 
 /* in exception.S */
@@ -187,6 +188,12 @@ mips_trap(struct trapframe *tf)
 		mainbus_interrupt(tf);
 
 		if (doadjust) {
+			/*
+			 * Going back to a thread at IPL-low: run any
+			 * work the handlers deferred first.
+			 */
+			softwork_run(true);
+
 			KASSERT(curthread->t_curspl == IPL_HIGH);
 			KASSERT(curthread->t_iplhigh_count == 1);
 			curthread->t_iplhigh_count--;
@@ -35,8 +35,13 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <copyinout.h>
+#include <kern/sysbatch.h>
+#include <trace.h>
 #include "opt-A2.h"
 
+static int syscall_dispatch(struct trapframe *tf, int32_t *retval);
+static int syscall_batch(userptr_t uents, unsigned n, int32_t *retval);
 
 /*
  * System call dispatcher.
@@ -79,7 +84,6 @@
 void
 syscall(struct trapframe *tf)
 {
-	int callno;
 	int32_t retval;
 	int err;
 
@@ -87,8 +91,6 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
 
-	callno = tf->tf_v0;
-
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
 	 * really return a value, just 0 for success and -1 on
@@ -100,6 +102,52 @@ syscall(struct trapframe *tf)
 
 	retval = 0;
 
+	trace(TRACE_SYSCALL, tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2);
+	err = syscall_dispatch(tf, &retval);
+	trace(TRACE_SYSRET, tf->tf_v0, err, retval, 0);
+
+	if (err) {
+		/*
+		 * Return the error code. This gets converted at
+		 * userlevel to a return value of -1 and the error
+		 * code in errno.
+		 */
+		tf->tf_v0 = err;
+		tf->tf_a3 = 1;      /* signal an error */
+	}
+	else {
+		/* Success. */
+		tf->tf_v0 = retval;
+		tf->tf_a3 = 0;      /* signal no error */
+	}
+	
+	/*
+	 * Now, advance the program counter, to avoid restarting
+	 * the syscall over and over again.
+	 */
+	
+	tf->tf_epc += 4;
+
+	/* Make sure the syscall code didn't forget to lower spl */
+	KASSERT(curthread->t_curspl == 0);
+	/* ...or leak any spinlocks */
+	KASSERT(curthread->t_iplhigh_count == 0);
+}
+
+/*
+ * Call the handler for system call number tf->tf_v0, with arguments
+ * from TF. Returns the error code, with the return value (if any) in
+ * *RETVAL and, for 64-bit returns, the low half in tf->tf_v1.
+ */
+static
+int
+syscall_dispatch(struct trapframe *tf, int32_t *retval)
+{
+	int callno;
+	int err;
+
+	callno = tf->tf_v0;
+
 	switch (callno) {
 	    case SYS_reboot:
 		err = sys_reboot(tf->tf_a0);
@@ -109,23 +157,122 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_setaffinity:
+		err = sys_setaffinity((uint32_t)tf->tf_a0);
+		break;
+
+	    case SYS_getaffinity:
+		err = sys_getaffinity((userptr_t)tf->tf_a0);
+		break;
 #if OPT_A2
 		case SYS_fork:
-		err = sys_fork(tf, (pid_t *)&retval);
+		err = sys_fork(tf, (pid_t *)retval);
+		break;
+
+		case SYS_vfork:
+		err = sys_vfork(tf, (pid_t *)retval);
 		break;
 
 		case SYS_execv:
-		err = sys_execv((char *) tf->tf_a0, (char **) tf->tf_a1, (int *)&retval);
+		err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
 		break;
 
 #endif
 
 #ifdef UW
+	case SYS_open:
+	  err = sys_open((userptr_t)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (mode_t)tf->tf_a2,
+			 (int *)(retval));
+	  break;
+	case SYS_read:
+	  err = sys_read((int)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int *)(retval));
+	  break;
+	case SYS_pread:
+	case SYS_pwrite:
+	  {
+	    /* pos is 64-bit, so it skips a3 and goes on the stack */
+	    off_t pos;
+
+	    err = copyin((const_userptr_t)(tf->tf_sp + 16), &pos,
+			 sizeof(pos));
+	    if (err) {
+	      break;
+	    }
+	    if (callno == SYS_pread) {
+	      err = sys_pread((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			      (int)tf->tf_a2, pos, (int *)(retval));
+	    }
+	    else {
+	      err = sys_pwrite((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			       (int)tf->tf_a2, pos, (int *)(retval));
+	    }
+	  }
+	  break;
+	case SYS_readv:
+	  err = sys_readv((int)tf->tf_a0,
+			  (userptr_t)tf->tf_a1,
+			  (int)tf->tf_a2,
+			  (int *)(retval));
+	  break;
+	case SYS_writev:
+	  err = sys_writev((int)tf->tf_a0,
+			   (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2,
+			   (int *)(retval));
+	  break;
+	case SYS_lseek:
+	  {
+	    /* pos is in a2/a3; whence is on the stack, past the
+	       slots for the register arguments */
+	    off_t pos, newpos;
+	    int whence;
+
+	    pos = ((off_t)tf->tf_a2 << 32) | (uint32_t)tf->tf_a3;
+	    err = copyin((const_userptr_t)(tf->tf_sp + 16), &whence,
+			 sizeof(whence));
+	    if (err) {
+	      break;
+	    }
+	    err = sys_lseek((int)tf->tf_a0, pos, whence, &newpos);
+	    if (err) {
+	      break;
+	    }
+	    /* 64-bit return value: high half in v0, low half in v1 */
+	    *retval = (int32_t)(newpos >> 32);
+	    tf->tf_v1 = (uint32_t)newpos;
+	  }
+	  break;
+	case SYS_close:
+	  err = sys_close((int)tf->tf_a0);
+	  break;
+	case SYS_dup2:
+	  err = sys_dup2((int)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (int *)(retval));
+	  break;
+	case SYS_pipe:
+	  err = sys_pipe((userptr_t)tf->tf_a0);
+	  break;
+	case SYS_fstat:
+	  err = sys_fstat((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+	  break;
+	case SYS_chdir:
+	  err = sys_chdir((userptr_t)tf->tf_a0);
+	  break;
+	case SYS_remove:
+	  err = sys_remove((userptr_t)tf->tf_a0);
+	  break;
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
 			  (userptr_t)tf->tf_a1,
 			  (int)tf->tf_a2,
-			  (int *)(&retval));
+			  (int *)(retval));
 	  break;
 	case SYS__exit:
 	  sys__exit((int)tf->tf_a0);
@@ -133,16 +280,22 @@ syscall(struct trapframe *tf)
 	  panic("unexpected return from sys__exit");
 	  break;
 	case SYS_getpid:
-	  err = sys_getpid((pid_t *)&retval);
+	  err = sys_getpid((pid_t *)retval);
 	  break;
 	case SYS_waitpid:
 	  err = sys_waitpid((pid_t)tf->tf_a0,
 			    (userptr_t)tf->tf_a1,
 			    (int)tf->tf_a2,
-			    (pid_t *)&retval);
+			    (pid_t *)retval);
 	  break;
 #endif // UW
 
+	    case SYS_sysbatch:
+		err = syscall_batch((userptr_t)tf->tf_a0,
+				    (unsigned)tf->tf_a1,
+				    retval);
+		break;
+
 	    /* Add stuff here */
  
 	default:
@@ -152,32 +305,106 @@ syscall(struct trapframe *tf)
 	}
 
 
-	if (err) {
-		/*
-		 * Return the error code. This gets converted at
-		 * userlevel to a return value of -1 and the error
-		 * code in errno.
-		 */
-		tf->tf_v0 = err;
-		tf->tf_a3 = 1;      /* signal an error */
+
+	return err;
+}
+
+/*
+ * Run one entry of a batch, using the scratch trapframe BTF. Calls
+ * that need more of the trapframe than the argument registers (fork
+ * and friends, and calls with arguments on the user stack) can't be
+ * batched.
+ */
+static
+void
+syscall_batchone(struct sysbatch *sb, struct trapframe *btf)
+{
+	int32_t retval;
+	int err;
+
+	switch (sb->sb_callno) {
+	    case SYS_fork:
+	    case SYS_vfork:
+	    case SYS_execv:
+	    case SYS__exit:
+	    case SYS_pread:
+	    case SYS_pwrite:
+	    case SYS_lseek:
+	    case SYS_sysbatch:
+		sb->sb_retval = 0;
+		sb->sb_err = EINVAL;
+		return;
 	}
-	else {
-		/* Success. */
-		tf->tf_v0 = retval;
-		tf->tf_a3 = 0;      /* signal no error */
+
+	btf->tf_v0 = sb->sb_callno;
+	btf->tf_a0 = sb->sb_args[0];
+	btf->tf_a1 = sb->sb_args[1];
+	btf->tf_a2 = sb->sb_args[2];
+	btf->tf_a3 = sb->sb_args[3];
+
+	retval = 0;
+	err = syscall_dispatch(btf, &retval);
+	sb->sb_retval = err ? 0 : retval;
+	sb->sb_err = err;
+}
+
+/*
+ * sysbatch: run the N calls queued at UENTS in order, posting each
+ * one's result back into its entry. The entries come in and go back
+ * out SYSBATCH_CHUNK at a time, so a batch costs one trap and a few
+ * bulk copies rather than a trap per call. One call failing doesn't
+ * stop the rest; only a bad UENTS does.
+ *
+ * The chunk is kmalloc'd rather than on the stack: the calls it runs
+ * (file system writes, say) need all of the small kernel stack.
+ */
+static
+int
+syscall_batch(userptr_t uents, unsigned n, int32_t *retval)
+{
+	struct sysbatch *ents;
+	struct trapframe btf;
+	userptr_t uchunk;
+	unsigned done, count, i;
+	int err;
+
+	if (n > SYSBATCH_MAX) {
+		return EINVAL;
 	}
-	
-	/*
-	 * Now, advance the program counter, to avoid restarting
-	 * the syscall over and over again.
-	 */
-	
-	tf->tf_epc += 4;
 
-	/* Make sure the syscall code didn't forget to lower spl */
-	KASSERT(curthread->t_curspl == 0);
-	/* ...or leak any spinlocks */
-	KASSERT(curthread->t_iplhigh_count == 0);
+	ents = kmalloc(SYSBATCH_CHUNK * sizeof(ents[0]));
+	if (ents == NULL) {
+		return ENOMEM;
+	}
+	bzero(&btf, sizeof(btf));
+
+	err = 0;
+	for (done = 0; done < n; done += count) {
+		count = n - done;
+		if (count > SYSBATCH_CHUNK) {
+			count = SYSBATCH_CHUNK;
+		}
+		uchunk = (userptr_t)((vaddr_t)uents + done * sizeof(ents[0]));
+
+		err = copyin(uchunk, ents, count * sizeof(ents[0]));
+		if (err) {
+			break;
+		}
+		for (i = 0; i < count; i++) {
+			syscall_batchone(&ents[i], &btf);
+		}
+		err = copyout(ents, uchunk, count * sizeof(ents[0]));
+		if (err) {
+			break;
+		}
+	}
+
+	kfree(ents);
+	if (err) {
+		return err;
+	}
+	*retval = n;
+	return 0;
 }
 
 #if OPT_A2
@@ -173,6 +173,24 @@ cpu_irqonoff(void)
         SET_STATUS(xoff);
 }
 
+/*
+ * Read the cycle counter. ($9 == c0_count; we can't use the symbolic
+ * name inside the asm string.)
+ */
+uint32_t
+cpu_getcycles(void)
+{
+	uint32_t x;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (x));
+	return x;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -48,6 +48,12 @@
  *
  * Note that we have no input buffering; characters typed too rapidly
  * will be lost.
+ *
+ * Output, on the other hand, is buffered: writers put characters in
+ * the output ring (see console.h) and carry on, and the device's
+ * write-done interrupt feeds it the next one. Writers only wait when
+ * the ring is full, and are woken all at once when it has drained to
+ * half full rather than for every character.
  */
 
 #include <types.h>
@@ -57,6 +63,7 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -67,6 +74,8 @@
  */
 static struct con_softc *the_console = NULL;
 
+#define CONSOLE_OUTPUT_MASK (CONSOLE_OUTPUT_BUFFER_SIZE - 1)
+
 /*
  * Lock so user I/Os are atomic.
  * We use two locks so readers waiting for input don't lock out writers.
@@ -122,6 +131,11 @@ putch_polled(struct con_softc *cs, int ch)
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
+/*
+ * Before polled output (a panic, say) push out whatever is still
+ * queued, so it comes out in order and isn't lost. Not if we're in
+ * the middle of the queueing code ourselves, though.
+ */
 static
 void
 putch_prepare_polled(struct con_softc *cs)
@@ -129,6 +143,16 @@ putch_prepare_polled(struct con_softc *cs)
 	if (cs->cs_startpolling != NULL) {
 		cs->cs_startpolling(cs->cs_devdata);
 	}
+
+	if (spinlock_do_i_hold(&cs->cs_outlock)) {
+		return;
+	}
+	spinlock_acquire(&cs->cs_outlock);
+	while (cs->cs_outtail != cs->cs_outhead) {
+		cs->cs_sendpolled(cs->cs_devdata,
+			cs->cs_outbuf[cs->cs_outtail++ & CONSOLE_OUTPUT_MASK]);
+	}
+	spinlock_release(&cs->cs_outlock);
 }
 
 static
@@ -143,14 +167,75 @@ putch_complete_polled(struct con_softc *cs)
 //////////////////////////////////////////////////
 
 /*
- * Print a character, using interrupts to wait for I/O completion.
+ * If the device is idle and there's output queued, send the next
+ * character. Called with cs_outlock held.
+ */
+static
+void
+con_kick(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+
+	if (!cs->cs_outbusy && cs->cs_outhead != cs->cs_outtail) {
+		ch = cs->cs_outbuf[cs->cs_outtail++ & CONSOLE_OUTPUT_MASK];
+		cs->cs_outbusy = true;
+		cs->cs_send(cs->cs_devdata, ch);
+	}
+}
+
+/*
+ * Queue LEN characters from BUF for output, waiting for room in the
+ * ring as needed. If CRLF is set, put a CR in front of each newline.
+ */
+static
+void
+con_write(struct con_softc *cs, const char *buf, size_t len, bool crlf)
+{
+	bool didcr = false;
+	char ch;
+	size_t i;
+
+	spinlock_acquire(&cs->cs_outlock);
+	i = 0;
+	while (i < len) {
+		if (cs->cs_outhead - cs->cs_outtail ==
+		    CONSOLE_OUTPUT_BUFFER_SIZE) {
+			/* Full; wait for con_start to drain some. */
+			con_kick(cs);
+			cs->cs_outwaiting++;
+			wchan_lock(cs->cs_outwchan);
+			spinlock_release(&cs->cs_outlock);
+			wchan_sleep(cs->cs_outwchan);
+			spinlock_acquire(&cs->cs_outlock);
+			continue;
+		}
+		ch = buf[i];
+		if (crlf && ch == '\n' && !didcr) {
+			ch = '\r';
+			didcr = true;
+		}
+		else {
+			i++;
+			didcr = false;
+		}
+		cs->cs_outbuf[cs->cs_outhead++ & CONSOLE_OUTPUT_MASK] = ch;
+	}
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
+}
+
+/*
+ * Print a character, queueing it for the interrupt-driven output.
  */
 static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	con_write(cs, &c, 1, false);
 }
 
 /*
@@ -203,8 +288,18 @@ void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
+	unsigned space;
+
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_outbusy = false;
+	con_kick(cs);
 
-	V(cs->cs_wsem);
+	space = CONSOLE_OUTPUT_BUFFER_SIZE - (cs->cs_outhead - cs->cs_outtail);
+	if (cs->cs_outwaiting > 0 && space >= CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		cs->cs_outwaiting = 0;
+		wchan_wakeall(cs->cs_outwchan);
+	}
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -298,54 +393,61 @@ con_close(struct device *dev)
 	return 0;
 }
 
+/*
+ * Bytes of a user write copied in at a time.
+ */
+#define CON_WRITE_CHUNK 128
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
+	char buf[CON_WRITE_CHUNK];
+	size_t len;
 	int result;
 	char ch;
-	struct lock *lk;
-
-	(void)dev;  // unused
-
-	if (uio->uio_rw==UIO_READ) {
-		lk = con_userlock_read;
-	}
-	else {
-		lk = con_userlock_write;
-	}
 
-	KASSERT(lk != NULL);
-	lock_acquire(lk);
-
-	while (uio->uio_resid > 0) {
-		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
+	if (uio->uio_rw==UIO_WRITE) {
+		/*
+		 * Copy in a chunk at a time and queue the lot, rather
+		 * than a uiomove and a putch for every character.
+		 */
+		KASSERT(con_userlock_write != NULL);
+		lock_acquire(con_userlock_write);
+		while (uio->uio_resid > 0) {
+			len = uio->uio_resid;
+			if (len > sizeof(buf)) {
+				len = sizeof(buf);
 			}
-			result = uiomove(&ch, 1, uio);
+			result = uiomove(buf, len, uio);
 			if (result) {
-				lock_release(lk);
+				lock_release(con_userlock_write);
 				return result;
 			}
-			if (ch=='\n') {
-				break;
-			}
+			con_write(cs, buf, len, true);
 		}
-		else {
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+		lock_release(con_userlock_write);
+		return 0;
+	}
+
+	KASSERT(con_userlock_read != NULL);
+	lock_acquire(con_userlock_read);
+	while (uio->uio_resid > 0) {
+		ch = getch();
+		if (ch=='\r') {
+			ch = '\n';
+		}
+		result = uiomove(&ch, 1, uio);
+		if (result) {
+			lock_release(con_userlock_read);
+			return result;
+		}
+		if (ch=='\n') {
+			break;
 		}
 	}
-	lock_release(lk);
+	lock_release(con_userlock_read);
 	return 0;
 }
 
@@ -398,7 +500,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *outwc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -418,30 +521,38 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	outwc = wchan_create("console write");
+	if (outwc == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(outwc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(outwc);
 		return ENOMEM;
 	}
+	/* Writers are served in order, so one process can't hog output. */
+	lock_sethandoff(wlk, true);
 
 	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
 
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwchan = outwc;
+	cs->cs_outwaiting = 0;
+	cs->cs_outbusy = false;
+	cs->cs_outhead = 0;
+	cs->cs_outtail = 0;
+
 	the_console = cs;
 	con_userlock_read = rlk;
 	con_userlock_write = wlk;
@@ -35,9 +35,16 @@
  *
  * devdata, send, and sendpolled are provided by the underlying
  * device, and are to be initialized by the attach routine.
+ *
+ * Output goes through a ring of CONSOLE_OUTPUT_BUFFER_SIZE bytes
+ * (a power of two) indexed by free-running counters: writers fill
+ * it, and the write-done interrupt sends the next character.
  */
 
+#include <spinlock.h>
+
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -49,10 +56,17 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	struct spinlock cs_outlock;	/* protects the output fields */
+	struct wchan *cs_outwchan;	/* writers waiting for room */
+	unsigned cs_outwaiting;		/* how many */
+	bool cs_outbusy;		/* device is sending a char */
+	unsigned char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_outhead;		/* chars ever queued */
+	unsigned cs_outtail;		/* chars ever sent */
 };
 
 /*
@@ -64,6 +64,9 @@
 /* I/O buffer offset */
 #define EMU_BUFFER    32768
 
+/* How long to wait for an operation before giving up on the device */
+#define EMU_TIMEOUT_MS  10000
+
 /* Operation codes for REG_OPER */
 #define EMU_OP_OPEN          1
 #define EMU_OP_CREATE        2
@@ -124,11 +127,23 @@ void
 emu_irq(void *dev)
 {
 	struct emu_softc *sc = dev;
+	bool waited;
 
+	/*
+	 * Only wake a thread that's still waiting. After a timeout
+	 * nobody is, and a V here would be taken by the next operation
+	 * as its own completion.
+	 */
+	spinlock_acquire(&sc->e_irqlock);
+	waited = sc->e_outstanding;
+	sc->e_outstanding = false;
 	sc->e_result = emu_rreg(sc, REG_RESULT);
 	emu_wreg(sc, REG_RESULT, 0);
+	spinlock_release(&sc->e_irqlock);
 
-	V(sc->e_sem);
+	if (waited) {
+		V(sc->e_sem);
+	}
 }
 
 /*
@@ -160,13 +175,43 @@ translate_err(struct emu_softc *sc, uint32_t code)
 }
 
 /*
- * Wait for an operation to complete, and return an errno for the result.
+ * Start operation OP, with the other registers already set up, wait
+ * for it to complete, and return an errno for the result. Call with
+ * e_lock held.
+ *
+ * If the device doesn't answer in time we give up on it for good:
+ * it may still be working on the old operation, and it would mix up
+ * anything we sent it afterwards.
  */
 static
 int
-emu_waitdone(struct emu_softc *sc)
+emu_op(struct emu_softc *sc, uint32_t op)
 {
-	P(sc->e_sem);
+	bool timedout;
+
+	if (sc->e_dead) {
+		return EIO;
+	}
+
+	spinlock_acquire(&sc->e_irqlock);
+	sc->e_outstanding = true;
+	spinlock_release(&sc->e_irqlock);
+	emu_wreg(sc, REG_OPER, op);
+
+	if (P_timed(sc->e_sem, EMU_TIMEOUT_MS)) {
+		spinlock_acquire(&sc->e_irqlock);
+		timedout = sc->e_outstanding;
+		sc->e_outstanding = false;
+		spinlock_release(&sc->e_irqlock);
+		if (timedout) {
+			kprintf("emu%d: operation timed out; disabling "
+				"device\n", sc->e_unit);
+			sc->e_dead = true;
+			return EIO;
+		}
+		/* It finished just now; take the V it left for us. */
+		P(sc->e_sem);
+	}
 	return translate_err(sc, sc->e_result);
 }
 
@@ -207,8 +252,7 @@ emu_open(struct emu_softc *sc, uint32_t handle, const char *name,
 	strcpy(sc->e_iobuf, name);
 	emu_wreg(sc, REG_IOLEN, strlen(name));
 	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_OPER, op);
-	result = emu_waitdone(sc);
+	result = emu_op(sc, op);
 
 	if (result==0) {
 		*newhandle = emu_rreg(sc, REG_HANDLE);
@@ -241,10 +285,10 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 		/* Retry operation up to 10 times */
 
 		emu_wreg(sc, REG_HANDLE, handle);
-		emu_wreg(sc, REG_OPER, EMU_OP_CLOSE);
-		result = emu_waitdone(sc);
+		result = emu_op(sc, EMU_OP_CLOSE);
 
-		if (result==EIO && retries < 10) {
+		/* A dead device won't do any better next time. */
+		if (result==EIO && retries < 10 && !sc->e_dead) {
 			kprintf("emu%d: I/O error on close, retrying\n", 
 				sc->e_unit);
 			retries++;
@@ -276,8 +320,7 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
 	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
-	emu_wreg(sc, REG_OPER, op);
-	result = emu_waitdone(sc);
+	result = emu_op(sc, op);
 	if (result) {
 		goto out;
 	}
@@ -336,8 +379,7 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		goto out;
 	}
 
-	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
-	result = emu_waitdone(sc);
+	result = emu_op(sc, EMU_OP_WRITE);
 
  out:
 	lock_release(sc->e_lock);
@@ -356,8 +398,7 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
-	result = emu_waitdone(sc);
+	result = emu_op(sc, EMU_OP_GETSIZE);
 	if (result==0) {
 		*retval = emu_rreg(sc, REG_IOLEN);
 	}
@@ -379,8 +420,7 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
-	result = emu_waitdone(sc);
+	result = emu_op(sc, EMU_OP_TRUNC);
 
 	lock_release(sc->e_lock);
 	return result;
@@ -1345,6 +1385,9 @@ config_emu(struct emu_softc *sc, int emuno)
 		return ENOMEM;
 	}
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
+	spinlock_init(&sc->e_irqlock);
+	sc->e_outstanding = false;
+	sc->e_dead = false;
 
 	snprintf(name, sizeof(name), "emu%d", emuno);
 
@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_EMU_H_
 #define _LAMEBUS_EMU_H_
 
+#include <spinlock.h>
 
 #define EMU_MAXIO       16384
 #define EMU_ROOTHANDLE  0
@@ -50,6 +51,9 @@ struct emu_softc {
 	struct lock *e_lock;
 	struct semaphore *e_sem;
 	void *e_iobuf;
+	struct spinlock e_irqlock;	/* protects e_outstanding */
+	bool e_outstanding;		/* operation started, not finished */
+	bool e_dead;			/* timed out; don't touch it again */
 
 	/* Written by the interrupt handler */
 	uint32_t e_result;
@@ -38,6 +38,7 @@
 #include <synch.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <trace.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
 
@@ -59,6 +60,12 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/*
+ * How long to wait for a sector before deciding the disk is stuck.
+ * Generous, because the disk may be spinning slowly.
+ */
+#define LHD_TIMEOUT_MS  5000
+
 /*
  * Shortcut for reading a register.
  */
@@ -96,14 +103,25 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 
 /*
  * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * completion semaphore, if anyone is still waiting for it. (After a
+ * timeout nobody is, and the next request would take the V as its
+ * own completion.)
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
+	bool waited;
+
+	trace(TRACE_DISKDONE, lh->lh_unit, err, 0, 0);
+	spinlock_acquire(&lh->lh_irqlock);
+	waited = lh->lh_outstanding;
+	lh->lh_outstanding = false;
 	lh->lh_result = err;
-	V(lh->lh_done);
+	spinlock_release(&lh->lh_irqlock);
+	if (waited) {
+		V(lh->lh_done);
+	}
 }
 
 /*
@@ -208,6 +226,7 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
 	uint32_t i;
 	uint32_t statval = LHD_WORKING;
+	bool stuck;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -247,10 +266,34 @@ lhd_io(struct device *d, struct uio *uio)
 		lhd_wreg(lh, LHD_REG_SECT, sector+i);
 
 		/* and start the operation. */
+		trace(TRACE_DISKSTART, lh->lh_unit, sector+i,
+		      uio->uio_rw == UIO_WRITE, 0);
+		spinlock_acquire(&lh->lh_irqlock);
+		lh->lh_outstanding = true;
+		spinlock_release(&lh->lh_irqlock);
 		lhd_wreg(lh, LHD_REG_STAT, statval);
 
 		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+		result = P_timed(lh->lh_done, LHD_TIMEOUT_MS);
+		if (result) {
+			spinlock_acquire(&lh->lh_irqlock);
+			stuck = lh->lh_outstanding;
+			lh->lh_outstanding = false;
+			spinlock_release(&lh->lh_irqlock);
+			if (stuck) {
+				/*
+				 * Abort the operation. If it completes
+				 * anyway, lhd_iodone now ignores it.
+				 */
+				kprintf("lhd%d: sector %u timed out\n",
+					lh->lh_unit, sector+i);
+				lhd_wreg(lh, LHD_REG_STAT, 0);
+				V(lh->lh_clear);
+				return EIO;
+			}
+			/* It finished just now; take the V it left. */
+			P(lh->lh_done);
+		}
 
 		/* Get the result value saved by the interrupt handler. */
 		result = lh->lh_result;
@@ -288,12 +331,16 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
+	spinlock_init(&lh->lh_irqlock);
+	lh->lh_outstanding = false;
 
 	/* Create the semaphores. */
 	lh->lh_clear = sem_create("lhd-clear", 1);
 	if (lh->lh_clear == NULL) {
 		return ENOMEM;
 	}
+	/* Serve requests in order, so none starve under load. */
+	sem_sethandoff(lh->lh_clear, true);
 	lh->lh_done = sem_create("lhd-done", 0);
 	if (lh->lh_done == NULL) {
 		sem_destroy(lh->lh_clear);
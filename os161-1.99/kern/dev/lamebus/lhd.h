@@ -31,6 +31,7 @@
 #define _LAMEBUS_LHD_H_
 
 #include <device.h>
+#include <spinlock.h>
 
 /*
  * Our sector size
@@ -54,6 +55,8 @@ struct lhd_softc {
 	int lh_result;			/* Result from I/O operation */
 	struct semaphore *lh_clear;	/* Synchronization */
 	struct semaphore *lh_done;
+	struct spinlock lh_irqlock;	/* protects lh_outstanding */
+	bool lh_outstanding;		/* operation started, not finished */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -0,0 +1,47 @@
+#ifndef _ARGPACK_H_
+#define _ARGPACK_H_
+
+/*
+ * Argument packing for execv and runprogram.
+ *
+ * The arguments are gathered into one kernel buffer, already laid out
+ * the way they go on the new program's stack: the argv array, then
+ * the strings. Only the array entries need fixing up once we know
+ * where on the stack it's going, and then the whole thing goes out
+ * with one copyout.
+ *
+ * The buffer starts out small (ARGPACK_SMALL bytes). Arguments that
+ * don't fit move to a single shared ARG_MAX buffer, which is held
+ * until argpack_cleanup, so execs with big argument lists take turns.
+ * (A buffer of ARG_MAX for every exec would have to come from whole
+ * pages, which dumbvm never gives back.)
+ *
+ *    argpack_copyin  - Gather the arguments from the user argv array
+ *                      UARGV. E2BIG if they don't fit in ARG_MAX.
+ *    argpack_kernel  - Gather ARGC arguments from the kernel array
+ *                      ARGV (for runprogram).
+ *    argpack_copyout - Put the arguments at the top of the user stack
+ *                      below *STACKPTR (in the current address
+ *                      space), updating *STACKPTR and returning the
+ *                      user address of argv in *UARGV.
+ *    argpack_cleanup - Free the buffer (or give back the shared one).
+ */
+
+/* Fits in a subpage allocation. */
+#define ARGPACK_SMALL	1024
+
+struct argpack {
+	char *ap_buf;			/* the buffer */
+	size_t ap_size;			/* its size */
+	bool ap_shared;			/* it's the shared ARG_MAX one */
+	size_t ap_len;			/* bytes in use */
+	int ap_argc;			/* number of arguments */
+};
+
+int argpack_copyin(struct argpack *ap, const_userptr_t uargv);
+int argpack_kernel(struct argpack *ap, int argc, char **argv);
+int argpack_copyout(struct argpack *ap, vaddr_t *stackptr, userptr_t *uargv);
+void argpack_cleanup(struct argpack *ap);
+
+
+#endif /* _ARGPACK_H_ */
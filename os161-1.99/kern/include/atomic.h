@@ -0,0 +1,30 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations, for the few places that need to update shared
+ * data without taking a spinlock (see the wakeup inbox in thread.c),
+ * or to build other kinds of spinlock (see spinlock.c).
+ *
+ *    atomic_swapptr - Store VAL in *P and return the old value.
+ *    atomic_casptr  - If *P is OLD, store VAL in it and return true;
+ *                     otherwise return false and leave it alone.
+ *    atomic_fetchadd - Add N to *P and return the old value.
+ *    atomic_membar  - Memory barrier: loads and stores before it are
+ *                     done before any after it.
+ *
+ * All are full compiler barriers.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+
+#endif /* _ATOMIC_H_ */
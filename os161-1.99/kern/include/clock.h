@@ -83,5 +83,45 @@ void clocksleep(int seconds);
  */
 void clocknap(int ticks);
 
+/*
+ * Timer ticks.
+ *
+ * clock_ticks() returns the number of timer ticks (one every
+ * LT_GRANULARITY usec) since boot. The count wraps around, so compare
+ * tick values with clock_tick_before() rather than with <.
+ * clock_mstoticks() converts milliseconds to ticks, rounding up.
+ */
+uint32_t clock_ticks(void);
+uint32_t clock_mstoticks(unsigned ms);
+#define clock_tick_before(a, b)  ((int32_t)((a) - (b)) < 0)
+
+/*
+ * Callouts: calling a function from the timer interrupt once a given
+ * tick is reached.
+ *
+ * callout_init	  Set up a callout to call FUNC(ARG).
+ * callout_schedule  Arm it to fire at tick WHEN (not an interval). It
+ *		  must not already be pending.
+ * callout_stop	  Disarm it. Returns true if it was pending, false if it
+ *		  had already fired. If the function is running right
+ *		  now, waits for it to finish; so once callout_stop
+ *		  returns, the callout may be reused or freed. Must not
+ *		  be called from interrupt context.
+ *
+ * The function runs in interrupt context, with no locks held, and so
+ * may not sleep.
+ */
+struct callout {
+	struct callout *co_next;	/* list of pending callouts */
+	uint32_t co_when;		/* tick to fire at */
+	void (*co_func)(void *);	/* what to call */
+	void *co_arg;			/* what to call it with */
+	volatile int co_state;		/* idle, pending, or running */
+};
+
+void callout_init(struct callout *co, void (*func)(void *), void *arg);
+void callout_schedule(struct callout *co, uint32_t when);
+bool callout_stop(struct callout *co);
+
 
 #endif /* _CLOCK_H_ */
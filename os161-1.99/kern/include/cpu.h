@@ -60,6 +60,11 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	struct thread *c_migrating;	/* Thread to send to another cpu */
+	struct thread *c_idlethread;	/* Runs while nothing else can */
+	struct work *c_softwork;	/* Soft work to run (see workq.c) */
+	struct work **c_softtail;	/* Where to add more */
+	bool c_softrunning;		/* Running soft work now */
 
 	/*
 	 * Accessed by other cpus.
@@ -69,6 +74,17 @@ struct cpu {
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus without locking.
+	 *
+	 * c_inbox is a list of threads other cpus have woken up for
+	 * us, linked through t_inboxnext; they go on the run queue
+	 * next time we're in thread_switch. c_unidling is set by
+	 * whoever sends us IPI_UNIDLE, so others don't bother.
+	 */
+	struct thread *volatile c_inbox;
+	volatile spinlock_data_t c_unidling;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -139,6 +155,13 @@ void cpu_irqon(void);
 void cpu_idle(void);
 void cpu_halt(void);
 
+/*
+ * Read the current CPU's cycle counter. It wraps around, and is not
+ * synchronized between CPUs, so it's only good for timing short
+ * stretches of code.
+ */
+uint32_t cpu_getcycles(void);
+
 /*
  * Interprocessor interrupts.
  *
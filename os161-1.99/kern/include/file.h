@@ -0,0 +1,84 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * An openfile is what open() creates: a vnode, the access mode, and
+ * the seek position. Descriptors that share one (after fork or dup2)
+ * share its position. It's reference counted, and goes away (closing
+ * the vnode) when the last descriptor does. of_offsetlock is held
+ * across each read, write, and seek, so I/O through a shared openfile
+ * doesn't go to the same place twice. Things that can't seek (the
+ * console, pipes) have no position, and skip the lock.
+ *
+ * A filetable maps descriptors to openfiles. Only its own process
+ * uses it, and processes have one thread, so it isn't locked.
+ *
+ * Functions:
+ *    openfile_open    - Open PATH (which is destroyed) with vfs_open.
+ *    openfile_create  - Make an openfile for VN, which is already
+ *                       open, with the access mode and O_APPEND from
+ *                       FLAGS. Takes over the caller's open of VN
+ *                       on success.
+ *    openfile_incref  - Add a reference.
+ *    openfile_decref  - Drop a reference, closing the file if it's
+ *                       the last one.
+ *
+ *    filetable_create  - Create an empty table.
+ *    filetable_destroy - Close everything and free the table.
+ *    filetable_closeall - Close everything.
+ *    filetable_copy    - Make TO's descriptors refer to the same open
+ *                        files as FROM's (for fork). TO must be empty.
+ *    filetable_get     - Look up a descriptor; EBADF if it isn't open.
+ *                        No reference is added.
+ *    filetable_place   - Put an openfile in the lowest free
+ *                        descriptor; EMFILE if there isn't one. The
+ *                        table takes over the caller's reference.
+ *    filetable_placeat - Put an openfile in descriptor FD, which must
+ *                        be in range, handing back what was there.
+ *    filetable_remove  - Take an openfile out of the table, handing
+ *                        back its reference; EBADF if it isn't open.
+ *    filetable_openconsole - Open the console as stdin, stdout, and
+ *                        stderr, where those aren't open already.
+ */
+
+#include <limits.h>
+#include <spinlock.h>
+
+struct vnode;
+struct lock;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_accmode;			/* O_RDONLY, O_WRONLY, or O_RDWR */
+	bool of_append;			/* O_APPEND */
+	bool of_seekable;		/* has a position at all */
+	struct lock *of_offsetlock;	/* protects of_offset */
+	off_t of_offset;
+	struct spinlock of_reflock;	/* protects of_refcount */
+	unsigned of_refcount;
+};
+
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+int openfile_create(struct vnode *vn, int flags, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+struct filetable {
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+struct filetable *filetable_create(void);
+void filetable_destroy(struct filetable *ft);
+void filetable_closeall(struct filetable *ft);
+void filetable_copy(struct filetable *from, struct filetable *to);
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_place(struct filetable *ft, struct openfile *of, int *ret);
+void filetable_placeat(struct filetable *ft, struct openfile *of, int fd,
+		       struct openfile **oldret);
+int filetable_remove(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_openconsole(struct filetable *ft);
+
+
+#endif /* _FILE_H_ */
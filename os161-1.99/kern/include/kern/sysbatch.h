@@ -0,0 +1,36 @@
+#ifndef _KERN_SYSBATCH_H_
+#define _KERN_SYSBATCH_H_
+
+/*
+ * Batched system calls.
+ *
+ * User code fills in an array of these, one per call, and hands the
+ * whole array to sysbatch(), which runs them in order in one trip
+ * into the kernel and fills in each entry's result. Each entry gives
+ * a system call number (see <kern/syscall.h>) and the four values
+ * that would go in the argument registers a0-a3; pointers go in as
+ * they are. Calls that don't work this way (fork, vfork, execv,
+ * _exit, calls that take 64-bit arguments, and sysbatch itself) fail
+ * with EINVAL.
+ *
+ * sysbatch returns the number of entries run, which is all of them,
+ * or -1 if the array itself couldn't be read or written (entries
+ * before the trouble may have been run).
+ */
+
+struct sysbatch {
+	int sb_callno;			/* in: SYS_ number */
+	int sb_args[4];			/* in: arguments */
+	int sb_retval;			/* out: return value */
+	int sb_err;			/* out: error code, or 0 */
+};
+
+/* Most entries in one batch. */
+#define SYSBATCH_MAX	1024
+
+#ifdef _KERNEL
+/* Entries copied in or out at a time. */
+#define SYSBATCH_CHUNK	32
+#endif
+
+#endif /* _KERN_SYSBATCH_H_ */
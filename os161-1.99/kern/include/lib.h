@@ -176,6 +176,12 @@ void beep(void);
  * kprintf_bootstrap sets up a lock for kprintf and should be called
  * during boot once malloc is available and before any additional
  * threads are created.
+ *
+ * kprintf_logger_bootstrap makes kprintf buffer its output per CPU,
+ * for a logger thread to print, instead of printing it straight away;
+ * call it once all the CPUs are running. kprintf_shutdown prints what
+ * is buffered and goes back to printing directly. (panic does that
+ * too, by itself.)
  */
 int kprintf(const char *format, ...) __PF(1,2);
 void panic(const char *format, ...) __PF(1,2);
@@ -184,6 +190,8 @@ void badassert(const char *expr, const char *file, int line, const char *func);
 void kgets(char *buf, size_t maxbuflen);
 
 void kprintf_bootstrap(void);
+void kprintf_logger_bootstrap(void);
+void kprintf_shutdown(void);
 
 /*
  * Other miscellaneous stuff
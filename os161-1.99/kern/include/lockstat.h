@@ -0,0 +1,72 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics.
+ *
+ * With "options lockstat", every acquire of a spinlock or a lock, and
+ * every sleep on a wait channel, is counted in a fixed-size table:
+ * how often it was acquired, how often it was already held, how many
+ * times we went round the spin loop waiting, how often we slept, and
+ * for how many cycles it was held. The cycle counters aren't kept in
+ * step across CPUs, so a lock released on another CPU than the one it
+ * was acquired on doesn't count towards the hold time. For locks,
+ * "spins" counts the times lock_acquire spun on a running holder
+ * rather than sleep, and the summary says how often that got it the
+ * lock.
+ *
+ * Entries are kept by name: locks and wait channels by the name they
+ * were created with, and spinlocks by the name given with
+ * spinlock_setname or SPINLOCK_NAMED_INITIALIZER. Objects sharing a
+ * name share an entry. Unnamed spinlocks are counted per call site
+ * of spinlock_acquire instead.
+ *
+ * Without the option the hooks compile to nothing.
+ */
+
+#include "opt-lockstat.h"
+
+struct spinlock;	/* from <spinlock.h> */
+struct lock;		/* from <synch.h> */
+struct wchan;		/* from <wchan.h> */
+
+/* How many entries lockstat_print shows by default. */
+#define LOCKSTAT_DEFAULT_TOPN	10
+
+#if OPT_LOCKSTAT
+
+/*
+ * Hooks, called by the lock code.
+ *
+ * spinlock_acquired and spinlock_release are called with the spinlock
+ * held; lock_acquired and lock_release with the lock's spinlock held;
+ * wchan_sleep with the wait channel locked.
+ */
+void lockstat_spinlock_acquired(struct spinlock *lk, unsigned spins,
+				const void *site);
+void lockstat_spinlock_release(struct spinlock *lk);
+void lockstat_lock_acquired(struct lock *lk, bool contended,
+			    unsigned spins, unsigned spinhits,
+			    unsigned sleeps);
+void lockstat_lock_release(struct lock *lk);
+void lockstat_wchan_sleep(struct wchan *wc);
+
+/*
+ * Print the TOPN most contended entries; zero all counters.
+ */
+void lockstat_print(unsigned topn);
+void lockstat_reset(void);
+
+#else
+
+#define lockstat_spinlock_acquired(lk, spins, site)	((void)(spins))
+#define lockstat_spinlock_release(lk)			((void)0)
+#define lockstat_lock_acquired(lk, contended, spins, spinhits, sleeps) \
+	((void)(contended), (void)(spins), (void)(spinhits), (void)(sleeps))
+#define lockstat_lock_release(lk)			((void)0)
+#define lockstat_wchan_sleep(wc)			((void)0)
+
+#endif /* OPT_LOCKSTAT */
+
+
+#endif /* _LOCKSTAT_H_ */
@@ -0,0 +1,30 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Pipes.
+ *
+ * A pipe is a PIPE_SIZE ring buffer with two vnodes, one for each
+ * end, which go into open files like any other vnode. Reading an
+ * empty pipe waits for data, or returns EOF once the write end is
+ * closed; writing a full pipe waits for room, or fails with EPIPE
+ * once the read end is closed.
+ *
+ *    pipe_create - Make a pipe, handing back its read and write
+ *                  ends, each already open once (so vfs_close them
+ *                  when done).
+ */
+
+/*
+ * Must be a power of two, and at least PIPE_BUF. Keep it below a page
+ * too, so kmalloc makes it a subpage block: whole pages never come
+ * back under dumbvm, and every pipe would leak one.
+ */
+#define PIPE_SIZE	1024
+
+struct vnode;
+
+int pipe_create(struct vnode **readret, struct vnode **writeret);
+
+
+#endif /* _PIPE_H_ */
@@ -39,11 +39,11 @@
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
 #include "opt-A2.h"
-#include <linkedlist.h>
 
 
 struct addrspace;
 struct vnode;
+struct filetable;
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -62,26 +62,51 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
-#ifdef UW
-  /* a vnode to refer to the console device */
-  /* this is a quick-and-dirty way to get console writes working */
-  /* you will probably need to change this when implementing file-related
-     system calls, since each process will need to keep track of all files
-     it has opened, not just the console. */
-  struct vnode *console;                /* a vnode for the console device */
-#endif
+	/* Files */
+	struct filetable *p_filetable;	/* open file descriptors */
+
+	/* CPU accounting totals of threads that have left (see proc_top) */
+	unsigned p_ticks;
+	unsigned p_volswitches;
+	unsigned p_involswitches;
+	uint32_t p_sleepticks;
 
 	/* add more material here as needed */
 #if OPT_A2
 	pid_t pid;
 	pid_t parentPid;
-	struct linkedlist *children;
-	struct cv *exitCv;
-	struct lock *exitLock;
+	/*
+	 * Children not yet waited for. The list is only touched by
+	 * the process itself (fork, waitpid, and _exit), so it isn't
+	 * locked.
+	 */
+	struct proc *children;		/* first child */
+	struct proc *nextSibling;	/* links in our parent's list */
+	struct proc *prevSibling;
+	/*
+	 * Children that have exited but not been waited for, oldest
+	 * first, linked through nextExited, so waitpid(-1) and
+	 * WNOHANG don't have to look at every child. waitLock
+	 * protects the queue and our children's zombie and
+	 * exitRetval; waitCv is signalled as each child joins it.
+	 */
+	struct proc *exitedHead;
+	struct proc *exitedTail;
+	struct proc *nextExited;
+	struct lock *waitLock;
+	struct cv *waitCv;
 	struct lock *parentLock;
 
 	bool zombie;
 	int exitRetval;
+
+	/*
+	 * After vfork: the parent's address space, which we're running
+	 * in until we exec or exit, and the semaphore the parent waits
+	 * on until then. Both NULL otherwise.
+	 */
+	struct addrspace *vforkAs;
+	struct semaphore *vforkSem;
 #endif
 };
 
@@ -95,7 +120,15 @@ extern struct semaphore *no_proc_sem;
 
 
 #ifdef OPT_A2
+/* Look up a process by PID; NULL if there's no such process. */
 struct proc *get_proc(pid_t pid);
+
+/* Add CHILD to, or take it off, PARENT's list of children. */
+void proc_addchild(struct proc *parent, struct proc *child);
+void proc_remchild(struct proc *parent, struct proc *child);
+
+/* Find PARENT's child with pid PID; NULL if it isn't one. */
+struct proc *proc_getchild(struct proc *parent, pid_t pid);
 #endif
 
 /* Call once during system startup to allocate data structures. */
@@ -119,5 +152,18 @@ struct addrspace *curproc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *curproc_setas(struct addrspace *);
 
+/*
+ * Call FUNC(proc, DATA) for every process, the kernel process first.
+ * No process is created or destroyed meanwhile.
+ */
+void proc_foreach(void (*func)(struct proc *, void *), void *data);
+
+/*
+ * Print a top-like table of the TOPN processes, and then TOPN threads,
+ * using the most CPU lately (menu command "top").
+ */
+#define PROC_TOP_DEFAULT_TOPN	10
+void proc_top(unsigned topn);
+
 
 #endif /* _PROC_H_ */
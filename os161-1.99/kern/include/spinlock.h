@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -53,16 +54,51 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * A spinlock is either a plain test-and-set lock or, if set up with
+ * spinlock_setticket or SPINLOCK_TICKET_INITIALIZER, a ticket lock.
+ * A ticket lock hands itself to waiting CPUs in the order they
+ * arrived, and they each spin reading a counter rather than all
+ * hammering the lock word with test-and-set, at the cost of an extra
+ * atomic operation when uncontended. Use it for heavily contended
+ * locks.
  */
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+	bool lk_ticket;			/* Is this a ticket lock? */
+	volatile unsigned lk_nextticket; /* Next ticket to hand out. */
+	volatile unsigned lk_nowserving; /* Ticket that holds the lock. */
+#if OPT_LOCKSTAT
+	const char *lk_name;		/* Name for lock statistics. */
+	struct lockstat *lk_stat;	/* Statistics entry for lk_name. */
+	struct lockstat *lk_holdstat;	/* Entry charged for this hold. */
+	uint32_t lk_acqtime;		/* Cycle count when acquired. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
+ * The named variant gives the lock a name for lock statistics (see
+ * <lockstat.h>); this should be a string constant. The ticket variant
+ * makes a named ticket lock.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_NAMED_INITIALIZER(name) \
+	{ .lk_lock = SPINLOCK_DATA_INITIALIZER, .lk_holder = NULL, \
+	  .lk_name = name }
+#define SPINLOCK_TICKET_INITIALIZER(name) \
+	{ .lk_lock = SPINLOCK_DATA_INITIALIZER, .lk_holder = NULL, \
+	  .lk_ticket = true, .lk_name = name }
+#define SPINLOCK_INITIALIZER	SPINLOCK_NAMED_INITIALIZER(NULL)
+#else
+#define SPINLOCK_INITIALIZER \
+	{ .lk_lock = SPINLOCK_DATA_INITIALIZER, .lk_holder = NULL }
+#define SPINLOCK_NAMED_INITIALIZER(name) SPINLOCK_INITIALIZER
+#define SPINLOCK_TICKET_INITIALIZER(name) \
+	{ .lk_lock = SPINLOCK_DATA_INITIALIZER, .lk_holder = NULL, \
+	  .lk_ticket = true }
+#endif
 
 /*
  * Spinlock functions.
@@ -79,6 +115,18 @@ struct spinlock {
 void spinlock_init(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
+/*
+ * setname	Give the lock a name for lock statistics. NAME should be
+ *		a string constant. Does nothing without "options lockstat".
+ */
+void spinlock_setname(struct spinlock *lk, const char *name);
+
+/*
+ * setticket	Make the lock a ticket lock (see above). Call before the
+ *		lock is first used.
+ */
+void spinlock_setticket(struct spinlock *lk);
+
 void spinlock_acquire(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
 
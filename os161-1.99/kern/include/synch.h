@@ -36,6 +36,22 @@
 
 
 #include <spinlock.h>
+#include <wchan.h>
+
+/*
+ * The synchronization objects below keep their spinlock and wait
+ * channel inline, and sem_create, lock_create, and cv_create keep the
+ * copy of the name in the same allocation, so each takes a single
+ * kmalloc. Objects that need to be static or global can instead use
+ * the _INITIALIZER macros and need no allocation at all; these take
+ * the object itself (so the wait list can point into it) and a string
+ * constant for the name, e.g.
+ *
+ *    static struct lock foo_lock = LOCK_INITIALIZER(foo_lock, "foo");
+ *
+ * Statically initialized objects must not be passed to the _destroy
+ * functions.
+ */
 
 /*
  * Dijkstra-style semaphore.
@@ -44,12 +60,17 @@
  * internally.
  */
 struct semaphore {
-        char *sem_name;
-	struct wchan *sem_wchan;
+        const char *sem_name;
+	struct wchan sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+        bool sem_handoff;               /* V hands straight to a waiter */
 };
 
+#define SEMAPHORE_INITIALIZER(sem, name, count) \
+	{ name, WCHAN_INITIALIZER((sem).sem_wchan, name), \
+	  SPINLOCK_INITIALIZER, count, false }
+
 struct semaphore *sem_create(const char *name, int initial_count);
 void sem_destroy(struct semaphore *);
 
@@ -62,6 +83,30 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P_timed is P, but gives up and returns ETIMEDOUT if the count hasn't
+ * come up within TIMEOUT_MS milliseconds. Returns 0 on success. With
+ * a timeout of 0 it never blocks.
+ */
+int P_timed(struct semaphore *, unsigned timeout_ms);
+
+/*
+ * Handoff mode.
+ *
+ * Normally V just bumps the count and wakes a waiter, which then has
+ * to compete for the count with any thread that happens to call P
+ * before it gets to run; a busy thread can take the semaphore over
+ * and over while the waiter starves. In handoff mode, V with someone
+ * waiting gives the count directly to the first waiter instead, so
+ * waiters are served strictly in order (by priority, then FIFO). This
+ * bounds waiting time at some cost in throughput, since every handoff
+ * has to wait for the woken thread to be scheduled.
+ *
+ * lock_sethandoff does the same for locks: lock_release passes
+ * ownership to the first waiter rather than leaving the lock free.
+ */
+void sem_sethandoff(struct semaphore *, bool handoff);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -73,15 +118,27 @@ void V(struct semaphore *);
  * (should be) made internally.
  */
 struct lock {
-        char *lk_name;
+        const char *lk_name;
         // add what you need here
         // (don't forget to mark things volatile as needed)
-        struct spinlock *spin;
+        struct spinlock lk_spin;
         bool held;
         struct thread *lk_holder;
-        struct wchan *lk_wchan;
+        struct wchan lk_wchan;
+        unsigned lk_nwaiters;           /* threads in lock_acquire's loop */
+        struct lock *lk_nextheld;       /* holder's list of held locks */
+        bool lk_handoff;                /* release passes it to a waiter */
+#if OPT_LOCKSTAT
+        struct lockstat *lk_stat;       /* statistics entry */
+        uint32_t lk_acqtime;            /* cycle count when acquired */
+        struct cpu *lk_acqcpu;          /* ...on this CPU's counter */
+#endif
 };
 
+#define LOCK_INITIALIZER(lk, name) \
+	{ .lk_name = name, .lk_spin = SPINLOCK_INITIALIZER, \
+	  .lk_wchan = WCHAN_INITIALIZER((lk).lk_wchan, name) }
+
 struct lock *lock_create(const char *name);
 void lock_acquire(struct lock *);
 
@@ -98,8 +155,33 @@ void lock_acquire(struct lock *);
  */
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
+
+/*
+ *    lock_tryacquire - Get the lock if it's free right now and return
+ *                   true; otherwise return false without blocking.
+ */
+bool lock_tryacquire(struct lock *);
 void lock_destroy(struct lock *);
 
+/*
+ *    lock_sethandoff - Turn handoff mode (see sem_sethandoff) on or
+ *                   off.
+ */
+void lock_sethandoff(struct lock *, bool handoff);
+
+/*
+ * Locks implement priority inheritance: a thread waiting in
+ * lock_acquire lends its priority to the holder of the lock, and
+ * transitively to whoever holds the lock *that* thread is waiting
+ * for, and so on. A thread gives up inherited priority when it
+ * releases the lock it was inherited through.
+ *
+ *    lock_update_priority - Recompute the current thread's effective
+ *                   priority after its base priority changes. Called
+ *                   by thread_setpriority.
+ */
+void lock_update_priority(void);
+
 
 /*
  * Condition variable.
@@ -116,12 +198,15 @@ void lock_destroy(struct lock *);
  */
 
 struct cv {
-        char *cv_name;
+        const char *cv_name;
         // add what you need here
         // (don't forget to mark things volatile as needed)
-        struct wchan *cv_wchan;
+        struct wchan cv_wchan;
 };
 
+#define CV_INITIALIZER(cv, name) \
+	{ name, WCHAN_INITIALIZER((cv).cv_wchan, name) }
+
 struct cv *cv_create(const char *name);
 void cv_destroy(struct cv *);
 
@@ -137,10 +222,73 @@ void cv_destroy(struct cv *);
  * on all operations with any particular CV.
  *
  * These operations must be atomic. You get to write them.
+ *
+ * cv_signal and cv_broadcast don't actually wake anyone: the waiters
+ * are moved onto the lock's wait channel and woken by lock_release
+ * as the lock is handed on ("wait morphing"). This is why the lock
+ * must be held, and why it must be the same lock the waiters used.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ *    cv_timedwait - Like cv_wait, but give up waiting after TIMEOUT_MS
+ *                   milliseconds. The lock is re-acquired either way.
+ *                   Returns 0 if woken by cv_signal or cv_broadcast,
+ *                   ETIMEDOUT if the time ran out.
+ */
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned timeout_ms);
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of threads may hold the lock for reading at once, or a
+ * single thread may hold it for writing. Writers get preference: once
+ * a writer is waiting, new readers wait behind it, so a steady stream
+ * of readers can't starve writers out. (This means a thread that
+ * already holds the lock for reading must not try to take it for
+ * reading again; if a writer has arrived in between, it deadlocks.)
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        const char *rw_name;
+        struct spinlock rw_spin;
+        struct wchan rw_readwchan;      /* readers waiting */
+        struct wchan rw_writewchan;     /* writers waiting */
+        unsigned rw_readers;            /* threads holding it to read */
+        unsigned rw_waitingwriters;     /* threads waiting to write */
+        struct thread *rw_writer;       /* thread holding it to write */
+};
+
+#define RWLOCK_INITIALIZER(rw, name) \
+	{ name, SPINLOCK_INITIALIZER, \
+	  WCHAN_INITIALIZER((rw).rw_readwchan, name), \
+	  WCHAN_INITIALIZER((rw).rw_writewchan, name), 0, 0, NULL }
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Blocks while a
+ *                   writer holds the lock or is waiting for it.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing. Blocks until no
+ *                   other thread holds the lock at all.
+ *    rwlock_release_write - Give up the write hold. Only the thread
+ *                   holding it for writing may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                   the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
 
 #endif /* _SYNCH_H_ */
@@ -58,14 +58,30 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_setaffinity(uint32_t mask);
+int sys_getaffinity(userptr_t user_mask);
 
 #if OPT_A2
 int sys_fork(struct trapframe *tf, pid_t *retval);
-int sys_execv(const char *program, char **args, int *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
+int sys_execv(userptr_t uprogram, userptr_t uargv);
 #endif
 
 #ifdef UW
+int sys_open(userptr_t upath, int flags, mode_t mode, int *retval);
+int sys_read(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_pread(int fdesc,userptr_t ubuf,unsigned int nbytes,off_t pos,int *retval);
+int sys_pwrite(int fdesc,userptr_t ubuf,unsigned int nbytes,off_t pos,int *retval);
+int sys_readv(int fdesc, userptr_t uiov, int iovcnt, int *retval);
+int sys_writev(int fdesc, userptr_t uiov, int iovcnt, int *retval);
+int sys_lseek(int fdesc, off_t pos, int whence, off_t *retval);
+int sys_close(int fdesc);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_pipe(userptr_t ufds);
+int sys_fstat(int fdesc, userptr_t ustat);
+int sys_chdir(userptr_t upath);
+int sys_remove(userptr_t upath);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
@@ -60,6 +60,12 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int pitest(int, char **);
+int rwtest(int, char **);
+int timedwaittest(int, char **);
+int handofftest(int, char **);
+int spinlockbench(int, char **);
+int workqtest(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -39,8 +39,11 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <clock.h>
 
 struct cpu;
+struct semaphore;
+struct wchan;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -56,6 +59,15 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Scheduling priorities. Larger numbers are more important; runnable
+ * threads of higher priority are always chosen before lower ones, and
+ * threads of equal priority are round-robin.
+ */
+#define PRI_MIN		0
+#define PRI_DEFAULT	16
+#define PRI_MAX		31
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -101,6 +113,49 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduling fields.
+	 *
+	 * t_basepri is the priority the thread asked for with
+	 * thread_setpriority(). t_priority is the priority it is
+	 * actually scheduled at; it can be raised above t_basepri while
+	 * the thread holds a lock that a more important thread is
+	 * waiting for (priority inheritance; see synch.c). t_priority
+	 * and t_blockedon are protected by the lock code's inheritance
+	 * spinlock. t_heldlocks is touched only by the thread itself.
+	 * t_handoff is protected by the semaphore's spinlock.
+	 */
+	int t_basepri;			/* Requested priority */
+	int t_priority;			/* Effective priority */
+	struct lock *t_blockedon;	/* Lock we're waiting for, if any */
+	struct lock *t_heldlocks;	/* Locks we hold (via lk_nextheld) */
+	uint32_t t_affinity;		/* CPUs we may run on (CPUMASK) */
+	struct semaphore *t_handoff;	/* Semaphore V handed us, if any */
+
+	/*
+	 * Timed sleep fields (see wchan_timedsleep).
+	 */
+	struct callout t_timeout;	/* Fires to end a timed sleep */
+	struct wchan *t_timedwchan;	/* Channel of the timed sleep */
+	volatile bool t_timedout;	/* True if the timeout woke us */
+
+	/* Link in a cpu's wakeup inbox (see thread_make_runnable). */
+	struct thread *t_inboxnext;
+
+	/*
+	 * CPU accounting, updated by thread_switch and hardclock. The
+	 * thread itself is the only writer; readers (proc_top) take
+	 * what they get. t_recent counts recent hardclocks, halved for
+	 * each THREAD_RECENT_HALFLIFE ms since t_recentstamp.
+	 */
+	unsigned t_ticks;		/* hardclocks we were running for */
+	unsigned t_recent;		/* ...recently, decaying */
+	uint32_t t_recentstamp;		/* clock tick t_recent was as of */
+	unsigned t_volswitches;		/* times we slept or yielded */
+	unsigned t_involswitches;	/* times we were preempted */
+	uint32_t t_sleepticks;		/* clock ticks spent asleep */
+	uint32_t t_sleepstart;		/* clock tick we last went to sleep */
+
 	/*
 	 * Public fields
 	 */
@@ -144,6 +199,25 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * CPU affinity. A thread only runs on the CPUs whose bits (CPUMASK of
+ * the CPU number) are set in its affinity mask. New threads inherit
+ * the mask of the thread that forked them.
+ *
+ * thread_fork_affinity is thread_fork with a mask for the new thread
+ * instead. thread_setaffinity sets the current thread's mask, moving
+ * it to an allowed CPU if need be. Masks are trimmed to the CPUs that
+ * exist; both return EINVAL if nothing is left. thread_cpumask
+ * returns the mask of all CPUs.
+ */
+#define CPUMASK(n)	((uint32_t)1 << (n))
+#define CPUMASK_ALL	0xffffffff
+int thread_fork_affinity(const char *name, struct proc *proc,
+                         void (*func)(void *, unsigned long),
+                         void *data1, unsigned long data2, uint32_t mask);
+int thread_setaffinity(uint32_t mask);
+uint32_t thread_cpumask(void);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -158,10 +232,33 @@ void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Set the (base) scheduling priority of the current thread. Must be
+ * between PRI_MIN and PRI_MAX. New threads start with the base
+ * priority of the thread that forked them.
+ */
+void thread_setpriority(int pri);
+
+/*
+ * Raise a thread's effective priority and move it up in the run queue
+ * or, if it's asleep on WC, in WC. For the lock code's priority
+ * inheritance.
+ */
+void thread_raisepriority(struct thread *t, int pri, struct wchan *wc);
+
+/*
+ * Periodic scheduler hook. Called from the timer interrupt.
  */
 void schedule(void);
 
+/*
+ * CPU accounting. thread_accounttick charges the current thread for
+ * one hardclock; it's called from hardclock. thread_recentticks
+ * returns a thread's decayed recent hardclock count.
+ */
+#define THREAD_RECENT_HALFLIFE	1000	/* ms */
+void thread_accounttick(void);
+unsigned thread_recentticks(struct thread *t);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -38,9 +38,10 @@ struct thread;	/* from <thread.h> */
  *
  * The two threadlistnodes in the threadlist structure are always on
  * the list, as bookends; this removes all the special cases in the
- * list handling code. However, note how THREADLIST_FOREACH works: you
- * iterate by starting with tl_head.tln_next, and stop when
- * itervar->tln_next is null, not when itervar itself becomes null.
+ * list handling code. The bookends have a null tln_self, which is
+ * how THREADLIST_FORALL and THREADLIST_FORALL_REV know to stop: the
+ * iteration variable is a thread, and becomes null on reaching the
+ * far bookend.
  *
  * ->tln_self always points to the thread that contains the
  * threadlistnode. We could avoid this if we wanted to instead use
@@ -66,6 +67,14 @@ struct threadlist {
 void threadlistnode_init(struct threadlistnode *tln, struct thread *self);
 void threadlistnode_cleanup(struct threadlistnode *tln);
 
+/*
+ * Initializer for a thread list that needs to be static or global.
+ * TL is the list itself, so the bookends can point at each other;
+ * e.g. "static struct threadlist foo = THREADLIST_INITIALIZER(foo);".
+ */
+#define THREADLIST_INITIALIZER(tl) \
+	{ { NULL, &(tl).tl_tail, NULL }, { &(tl).tl_head, NULL, NULL }, 0 }
+
 /* Initialize and clean up a thread list. Must be empty at cleanup. */
 void threadlist_init(struct threadlist *tl);
 void threadlist_cleanup(struct threadlist *tl);
@@ -86,15 +95,19 @@ void threadlist_insertbefore(struct threadlist *tl,
 			     struct thread *addee, struct thread *onlist);
 void threadlist_remove(struct threadlist *tl, struct thread *t);
 
-/* Iteration; itervar should previously be declared as (struct thread *) */
+/*
+ * Iteration; itervar should previously be declared as (struct thread *).
+ * The bookends have a null tln_self, so reaching either one ends the
+ * loop; this also makes iterating over an empty list safe.
+ */
 #define THREADLIST_FORALL(itervar, tl) \
 	for ((itervar) = (tl).tl_head.tln_next->tln_self; \
-	     (itervar)->t_listnode.tln_next != NULL; \
+	     (itervar) != NULL; \
 	     (itervar) = (itervar)->t_listnode.tln_next->tln_self)
 
 #define THREADLIST_FORALL_REV(itervar, tl) \
 	for ((itervar) = (tl).tl_tail.tln_prev->tln_self; \
-	     (itervar)->t_listnode.tln_prev != NULL; \
+	     (itervar) != NULL; \
 	     (itervar) = (itervar)->t_listnode.tln_prev->tln_self)
 
 
@@ -0,0 +1,93 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Kernel event tracing.
+ *
+ * With "options trace", the kernel can record a stream of fixed-size
+ * binary events into a ring buffer per CPU: system call entry and
+ * exit, context switches, VM faults, disk transfers, and sleeping on
+ * a contended lock. Recording is cheap (no locks, no formatting) so
+ * it can stay on under load; once a ring fills, new events overwrite
+ * the oldest ones.
+ *
+ * Tracing is off until trace_start. trace_dump stops it and writes
+ * what's been recorded to a file (e.g. on emu0, to be read on the
+ * host): a struct trace_header, then for each CPU in turn its records
+ * oldest first, th_nrecords struct trace_records in all. Everything
+ * is in the machine's byte order, which is big-endian on sys161.
+ *
+ * Without the option the hooks compile to nothing.
+ */
+
+#include "opt-trace.h"
+
+/* Event codes, for tr_event, and what goes in tr_args. */
+#define TRACE_SYSCALL	1	/* callno, a0, a1, a2 */
+#define TRACE_SYSRET	2	/* callno, error, retval */
+#define TRACE_SWITCH	3	/* next thread, state we left in */
+#define TRACE_VMFAULT	4	/* fault type, address */
+#define TRACE_DISKSTART	5	/* unit, sector, write? */
+#define TRACE_DISKDONE	6	/* unit, error */
+#define TRACE_LOCKWAIT	7	/* lock, holder */
+
+struct trace_record {
+	uint32_t tr_sec;		/* time recorded, from gettime */
+	uint32_t tr_nsec;
+	uint16_t tr_event;		/* TRACE_* */
+	uint16_t tr_cpu;		/* CPU number */
+	uint32_t tr_thread;		/* address of the current thread */
+	uint32_t tr_args[4];		/* depends on tr_event */
+};
+
+#define TRACE_MAGIC	0x54524331	/* "TRC1" */
+#define TRACE_VERSION	1
+
+struct trace_header {
+	uint32_t th_magic;		/* TRACE_MAGIC */
+	uint16_t th_version;		/* TRACE_VERSION */
+	uint16_t th_ncpus;		/* number of CPUs */
+	uint32_t th_recsize;		/* sizeof(struct trace_record) */
+	uint32_t th_nrecords;		/* records following */
+};
+
+/* Events kept per CPU. */
+#define TRACE_NRECORDS	2048
+
+/* Where the menu's "tr dump" writes by default. */
+#define TRACE_DEFAULT_FILE	"emu0:trace.out"
+
+#if OPT_TRACE
+
+extern volatile bool trace_enabled;
+
+/*
+ * Hook, called wherever an event happens; may be called from anywhere,
+ * including interrupt handlers and with spinlocks held. The macro
+ * keeps the cost to a test while tracing is off.
+ */
+void trace_event(unsigned event, uint32_t a0, uint32_t a1,
+		 uint32_t a2, uint32_t a3);
+
+#define trace(event, a0, a1, a2, a3) \
+	(trace_enabled ? \
+	 trace_event(event, (uint32_t)(a0), (uint32_t)(a1), \
+		     (uint32_t)(a2), (uint32_t)(a3)) : \
+	 (void)0)
+
+/*
+ * Start (discarding anything already recorded) and stop recording;
+ * stop and write out everything recorded to the file PATH.
+ */
+int trace_start(void);
+void trace_stop(void);
+int trace_dump(const char *path);
+
+#else
+
+#define trace(event, a0, a1, a2, a3)	((void)0)
+
+#endif /* OPT_TRACE */
+
+
+#endif /* _TRACE_H_ */
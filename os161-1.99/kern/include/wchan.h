@@ -34,8 +34,34 @@
  * Wait channel.
  */
 
+#include <spinlock.h>
+#include <threadlist.h>
 
-struct wchan; /* Opaque */
+/*
+ * This structure is made public so wait channels can be embedded in
+ * other objects (such as the synchronization primitives) rather than
+ * malloc'd; however, code that uses wait channels should not look
+ * inside the structure directly but always use the functions below.
+ */
+struct wchan {
+	const char *wc_name;		/* name for this channel */
+	struct threadlist wc_threads;	/* list of waiting threads */
+	struct spinlock wc_lock;	/* lock for mutual exclusion */
+};
+
+/*
+ * Initializer for a wait channel that needs to be static or global,
+ * or part of such an object. WC is the wait channel itself.
+ */
+#define WCHAN_INITIALIZER(wc, name) \
+	{ name, THREADLIST_INITIALIZER((wc).wc_threads), SPINLOCK_INITIALIZER }
+
+/*
+ * Initialize and clean up a wait channel in place. NAME is treated as
+ * for wchan_create. Must be empty and unlocked at cleanup.
+ */
+void wchan_init(struct wchan *wc, const char *name);
+void wchan_cleanup(struct wchan *wc);
 
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
@@ -71,15 +97,41 @@ void wchan_unlock(struct wchan *wc);
  */
 void wchan_sleep(struct wchan *wc);
 
+/*
+ * Like wchan_sleep, but return ETIMEDOUT if not awakened by tick
+ * DEADLINE (see clock_ticks in <clock.h>); otherwise return 0.
+ * Likewise the channel must be locked, and is unlocked on return.
+ */
+int wchan_timedsleep(struct wchan *wc, uint32_t deadline);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The queue should not already be locked.
  *
- * The current implementation is FIFO but this is not promised by the
- * interface.
+ * Threads are woken in priority order, FIFO among threads of equal
+ * priority; the handoff modes of locks and semaphores rely on this.
+ *
+ * wchan_wakeone returns the thread it woke, or NULL if there was
+ * nobody. The thread may already be running by the time it returns,
+ * so the pointer is only safe to use if the caller holds something
+ * the thread has to get before it can go anywhere.
  */
-void wchan_wakeone(struct wchan *wc);
+struct thread *wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Move one thread, or all threads, sleeping on FROM over to TO,
+ * without waking them; they'll wake when TO is woken. Both channels
+ * must be locked. Returns the number of threads moved.
+ */
+unsigned wchan_transfer(struct wchan *from, struct wchan *to, bool all);
+
+/*
+ * Return the highest priority of any thread sleeping on the channel,
+ * or -1 if the channel is empty. The channel should not already be
+ * locked.
+ */
+int wchan_maxpriority(struct wchan *wc);
+
 
 #endif /* _WCHAN_H_ */
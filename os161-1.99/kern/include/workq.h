@@ -0,0 +1,64 @@
+#ifndef _WORKQ_H_
+#define _WORKQ_H_
+
+/*
+ * Deferred work, for getting things out of interrupt handlers.
+ *
+ * A struct work is a function and argument to call later. It can be
+ * queued in one of two places:
+ *
+ *    softwork_schedule - Run it on this CPU on the way out of the
+ *                        interrupt, once the handler is done, before
+ *                        returning to a thread that was running at
+ *                        IPL-low. It runs with interrupts on, but in
+ *                        interrupt context: it may not sleep.
+ *
+ *    workqueue_enqueue - Run it in one of the queue's worker threads,
+ *                        where it may sleep. sys_workqueue is the
+ *                        general-purpose one.
+ *
+ * Both may be called from interrupt handlers. A work item that is
+ * already queued isn't queued again (both then return false), so a
+ * driver can schedule the same item for every interrupt and have all
+ * the completions seen so far handled in one call. An item is no
+ * longer queued once its function starts, so the function can
+ * requeue it.
+ *
+ * softwork_run is for the trap code (and the idle loop) and drains
+ * this CPU's soft work; see workq.c.
+ */
+
+#include <spinlock.h>
+
+struct work {
+	struct work *w_next;		/* queue link */
+	void (*w_func)(void *);		/* what to call */
+	void *w_arg;			/* and its argument */
+	volatile spinlock_data_t w_queued; /* set while queued */
+};
+
+#define WORK_INITIALIZER(func, arg) \
+	{ .w_next = NULL, .w_func = (func), .w_arg = (arg), \
+	  .w_queued = SPINLOCK_DATA_INITIALIZER }
+
+void work_init(struct work *w, void (*func)(void *), void *arg);
+
+bool softwork_schedule(struct work *w);
+void softwork_run(bool lowerspl);
+
+struct workqueue;	/* Opaque. */
+
+struct workqueue *workqueue_create(const char *name, unsigned nthreads,
+				   uint32_t affinity);
+bool workqueue_enqueue(struct workqueue *wq, struct work *w);
+
+extern struct workqueue *sys_workqueue;
+
+/* Number of worker threads in sys_workqueue */
+#define SYS_WORKQUEUE_NTHREADS	4
+
+/* Create sys_workqueue. Called once from boot. */
+void workq_bootstrap(void);
+
+
+#endif /* _WORKQ_H_ */
@@ -35,6 +35,11 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <atomic.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <clock.h>
+#include <proc.h>
 #include <mainbus.h>
 #include <vfs.h>          // for vfs_sync()
 
@@ -42,11 +47,58 @@
 /* Flags word for DEBUG() macro. */
 uint32_t dbflags = 0;
 
-/* Lock for non-polled kprintfs */
-static struct lock *kprintf_lock;
+/* Lock for non-polled kprintfs; usable once kprintf_bootstrap runs */
+static struct lock kprintf_lock = LOCK_INITIALIZER(kprintf_lock,
+						   "kprintf_lock");
+static bool kprintf_lock_ready;
 
 /* Lock for polled kprintfs */
-static struct spinlock kprintf_spinlock;
+static struct spinlock kprintf_spinlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Once the logger thread is running, kprintf formats into a buffer
+ * belonging to the current CPU instead of printing, and the logger
+ * prints it later. Each buffer is a ring indexed by free-running
+ * counters: only its own CPU (with interrupts off, so nothing else
+ * there can get in) moves kl_head, and kl_tail only moves with
+ * kprintf_lock held, so no lock is needed to put a message in.
+ * Messages from different CPUs can come out in a different order
+ * than they went in.
+ *
+ * A message that doesn't fit is left out of the buffer, and if the
+ * caller can sleep it takes kprintf_lock and prints everything
+ * buffered and then the message itself directly. Only callers that
+ * can't (interrupt handlers, and threads holding spinlocks) have a
+ * message cut short; what's lost is counted and reported.
+ *
+ * The logger is only woken directly if kprintf was called with no
+ * spinlocks held (waking it takes some); otherwise it notices on its
+ * next periodic check.
+ */
+#define KLOG_SIZE	4096		/* per CPU; a power of two */
+#define KLOG_MASK	(KLOG_SIZE - 1)
+#define KLOG_POLLMS	50		/* logger checks at least this often */
+
+struct klog {
+	char *kl_buf;			/* KLOG_SIZE bytes */
+	volatile unsigned kl_head;	/* bytes put in; own CPU only */
+	volatile unsigned kl_tail;	/* bytes printed; logger only */
+	volatile unsigned kl_dropped;	/* bytes that didn't fit */
+	unsigned kl_reported;		/* of those, how many reported */
+};
+
+/* Where a message is going, as it's formatted. */
+struct klogcursor {
+	struct klog *kc_log;
+	unsigned kc_head;
+	bool kc_full;			/* ran out of room */
+};
+
+static struct klog *klogs;		/* one per CPU */
+static unsigned nklogs;
+static volatile bool klog_ready;	/* buffering is on */
+static struct wchan *klog_wchan;	/* logger sleeps here */
+static volatile bool klog_sleeping;
 
 
 /*
@@ -62,13 +114,9 @@ static struct spinlock kprintf_spinlock;
 void
 kprintf_bootstrap(void)
 {
-	KASSERT(kprintf_lock == NULL);
+	KASSERT(kprintf_lock_ready == false);
 
-	kprintf_lock = lock_create("kprintf_lock");
-	if (kprintf_lock == NULL) {
-		panic("Could not create kprintf_lock\n");
-	}
-	spinlock_init(&kprintf_spinlock);
+	kprintf_lock_ready = true;
 }
 
 /*
@@ -87,6 +135,238 @@ console_send(void *junk, const char *data, size_t len)
 	}
 }
 
+/*
+ * Put characters in a CPU's log buffer. Backend for __printf. Nothing
+ * is visible to the logger until kc_head is copied to kl_head.
+ */
+static
+void
+klog_send(void *vkc, const char *data, size_t len)
+{
+	struct klogcursor *kc = vkc;
+	struct klog *kl = kc->kc_log;
+	size_t i;
+
+	for (i=0; i<len && !kc->kc_full; i++) {
+		if (kc->kc_head - kl->kl_tail == KLOG_SIZE) {
+			kc->kc_full = true;
+			return;
+		}
+		kl->kl_buf[kc->kc_head++ & KLOG_MASK] = data[i];
+	}
+}
+
+/*
+ * Print everything in a CPU's log buffer. The logger, and kprintf
+ * when a message doesn't fit, do this with kprintf_lock held; panic
+ * and kprintf_shutdown do it once nothing else should be.
+ */
+static
+void
+klog_drain(struct klog *kl)
+{
+	unsigned head, tail, dropped;
+	char msg[64];
+
+	head = kl->kl_head;
+	/* See the data the head covers. */
+	atomic_membar();
+	for (tail = kl->kl_tail; tail != head; tail++) {
+		putch(kl->kl_buf[tail & KLOG_MASK]);
+	}
+	/* Done with it before the space is handed back. */
+	atomic_membar();
+	kl->kl_tail = tail;
+
+	dropped = kl->kl_dropped;
+	if (dropped != kl->kl_reported) {
+		snprintf(msg, sizeof(msg), "[kprintf: %u bytes lost]\n",
+			 dropped - kl->kl_reported);
+		console_send(NULL, msg, strlen(msg));
+		kl->kl_reported = dropped;
+	}
+}
+
+static
+bool
+klog_pending(void)
+{
+	unsigned i;
+
+	for (i=0; i<nklogs; i++) {
+		if (klogs[i].kl_head != klogs[i].kl_tail ||
+		    klogs[i].kl_dropped != klogs[i].kl_reported) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The logger thread: print whatever the CPUs have buffered, then
+ * sleep until woken or KLOG_POLLMS goes by.
+ */
+static
+void
+klog_thread(void *junk1, unsigned long junk2)
+{
+	unsigned i;
+
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		lock_acquire(&kprintf_lock);
+		putch_prepare();
+		for (i=0; i<nklogs; i++) {
+			klog_drain(&klogs[i]);
+		}
+		putch_complete();
+		lock_release(&kprintf_lock);
+
+		wchan_lock(klog_wchan);
+		klog_sleeping = true;
+		atomic_membar();
+		if (klog_pending()) {
+			klog_sleeping = false;
+			wchan_unlock(klog_wchan);
+			continue;
+		}
+		wchan_timedsleep(klog_wchan,
+				 clock_ticks() + clock_mstoticks(KLOG_POLLMS));
+		klog_sleeping = false;
+	}
+}
+
+/*
+ * Format a message into the current CPU's buffer, or if it doesn't
+ * fit and we can sleep, print it directly.
+ */
+static
+int
+klog_vprintf(const char *fmt, va_list ap)
+{
+	struct klogcursor kc;
+	va_list ap2;
+	bool canwait;
+	unsigned i;
+	int chars, spl;
+
+	canwait = !curthread->t_in_interrupt &&
+		curthread->t_iplhigh_count == 0;
+	va_copy(ap2, ap);
+
+	/* Stay on this CPU, and keep its interrupts out of the buffer. */
+	spl = splhigh();
+	kc.kc_log = &klogs[curcpu->c_number];
+	kc.kc_head = kc.kc_log->kl_head;
+	kc.kc_full = false;
+	chars = __vprintf(klog_send, &kc, fmt, ap);
+
+	if (kc.kc_full && canwait) {
+		/* Drop what we put in, and print it all ourselves. */
+		splx(spl);
+		lock_acquire(&kprintf_lock);
+		putch_prepare();
+		for (i=0; i<nklogs; i++) {
+			klog_drain(&klogs[i]);
+		}
+		__vprintf(console_send, NULL, fmt, ap2);
+		putch_complete();
+		lock_release(&kprintf_lock);
+		va_end(ap2);
+		return chars;
+	}
+	va_end(ap2);
+
+	if (kc.kc_full) {
+		kc.kc_log->kl_dropped +=
+			chars - (kc.kc_head - kc.kc_log->kl_head);
+	}
+	/* The data has to be there before the head says so. */
+	atomic_membar();
+	kc.kc_log->kl_head = kc.kc_head;
+	splx(spl);
+
+	if (canwait) {
+		atomic_membar();
+		if (klog_sleeping) {
+			klog_sleeping = false;
+			wchan_wakeone(klog_wchan);
+		}
+	}
+	return chars;
+}
+
+/*
+ * Start buffering kprintf output and the logger thread that prints
+ * it. Call once all the CPUs are running.
+ */
+void
+kprintf_logger_bootstrap(void)
+{
+	uint32_t mask;
+	unsigned i;
+	int result;
+
+	/* The CPUs are numbered from 0, one bit each in the mask. */
+	mask = thread_cpumask();
+	nklogs = 0;
+	while (nklogs < 32 && (mask & CPUMASK(nklogs)) != 0) {
+		nklogs++;
+	}
+
+	klogs = kmalloc(nklogs * sizeof(*klogs));
+	klog_wchan = wchan_create("kprintf logger");
+	if (klogs == NULL || klog_wchan == NULL) {
+		panic("kprintf_logger_bootstrap: Out of memory\n");
+	}
+	for (i=0; i<nklogs; i++) {
+		klogs[i].kl_buf = kmalloc(KLOG_SIZE);
+		if (klogs[i].kl_buf == NULL) {
+			panic("kprintf_logger_bootstrap: Out of memory\n");
+		}
+		klogs[i].kl_head = 0;
+		klogs[i].kl_tail = 0;
+		klogs[i].kl_dropped = 0;
+		klogs[i].kl_reported = 0;
+	}
+	klog_sleeping = false;
+
+	result = thread_fork("kprintf logger", kproc, klog_thread, NULL, 0);
+	if (result) {
+		panic("kprintf_logger_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+
+	atomic_membar();
+	klog_ready = true;
+}
+
+/*
+ * Go back to printing directly, after printing whatever is buffered.
+ * For the shutdown path, so nothing is left in the buffers when the
+ * system halts.
+ */
+void
+kprintf_shutdown(void)
+{
+	unsigned i;
+
+	if (!klog_ready) {
+		return;
+	}
+	lock_acquire(&kprintf_lock);
+	klog_ready = false;
+	atomic_membar();
+	putch_prepare();
+	for (i=0; i<nklogs; i++) {
+		klog_drain(&klogs[i]);
+	}
+	putch_complete();
+	lock_release(&kprintf_lock);
+}
+
 /*
  * Printf to the console.
  */
@@ -97,12 +377,19 @@ kprintf(const char *fmt, ...)
 	va_list ap;
 	bool dolock;
 
-	dolock = kprintf_lock != NULL
+	if (klog_ready) {
+		va_start(ap, fmt);
+		chars = klog_vprintf(fmt, ap);
+		va_end(ap);
+		return chars;
+	}
+
+	dolock = kprintf_lock_ready
 		&& curthread->t_in_interrupt == false
 		&& curthread->t_iplhigh_count == 0;
 
 	if (dolock) {
-		lock_acquire(kprintf_lock);
+		lock_acquire(&kprintf_lock);
 	}
 	else {
 		spinlock_acquire(&kprintf_spinlock);
@@ -115,7 +402,7 @@ kprintf(const char *fmt, ...)
 
 	putch_complete();
 	if (dolock) {
-		lock_release(kprintf_lock);
+		lock_release(&kprintf_lock);
 	}
 	else {
 		spinlock_release(&kprintf_spinlock);
@@ -164,6 +451,22 @@ panic(const char *fmt, ...)
 
 		/* Kill off other threads and halt other CPUs. */
 		thread_panic();
+
+		/*
+		 * Print from here on directly, and get out whatever
+		 * was buffered. The logger is dead, so never mind
+		 * whose the buffers were.
+		 */
+		if (klog_ready) {
+			unsigned i;
+
+			klog_ready = false;
+			putch_prepare();
+			for (i=0; i<nklogs; i++) {
+				klog_drain(&klogs[i]);
+			}
+			putch_complete();
+		}
 	}
 
 	if (evil == 2) {
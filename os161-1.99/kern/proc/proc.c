@@ -49,7 +49,7 @@
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
-#include <kern/fcntl.h>
+#include <file.h>
 #include "opt-A2.h"
 
 #if OPT_A2
@@ -75,22 +75,139 @@ struct semaphore *no_proc_sem;
 #endif  // UW
 
 #ifdef OPT_A2
-unsigned int max_procs = __PID_MAX;
-unsigned int min_procs = __PID_MIN;
-static volatile struct proc *pidArray[__PID_MAX];
-#endif
+/*
+ * The process table. Lookups (get_proc, proc_foreach) hold
+ * proc_table_lock for reading, so they don't get in each other's
+ * way; only adding and removing processes hold it for writing.
+ *
+ * PIDs come from pid_bitmap, one bit per PID, with the ones that
+ * aren't valid PIDs permanently set. The search for a free one starts
+ * at pid_hint, just past the last one handed out, so a PID isn't
+ * reused until the allocator has been all the way round. Looking at
+ * a word of the bitmap at a time, that's a short search unless nearly
+ * every PID is in use.
+ */
+#define PID_WORDS	((__PID_MAX + 31) / 32)
+static struct proc *proc_table[__PID_MAX];
+static struct rwlock *proc_table_lock;
+static uint32_t pid_bitmap[PID_WORDS];
+static pid_t pid_hint;
 
+/*
+ * Allocate a PID. Returns -1 if they're all in use. Call with the
+ * table locked for writing.
+ */
+static
+pid_t
+pid_alloc(void)
+{
+	unsigned i, word, bit;
+	uint32_t bits;
+	pid_t pid;
+
+	KASSERT(rwlock_do_i_hold_write(proc_table_lock));
+
+	/* Skip the ones below the hint in its word the first time. */
+	word = pid_hint / 32;
+	bits = pid_bitmap[word] | ((1U << (pid_hint % 32)) - 1);
+
+	for (i = 0; i <= PID_WORDS; i++) {
+		if (bits != 0xffffffff) {
+			for (bit = 0; bits & (1U << bit); bit++) {
+				/* nothing */
+			}
+			pid_bitmap[word] |= 1U << bit;
+			pid = word * 32 + bit;
+			pid_hint = pid + 1 < __PID_MAX ? pid + 1 : __PID_MIN;
+			return pid;
+		}
+		word = (word + 1) % PID_WORDS;
+		bits = pid_bitmap[word];
+	}
+	return -1;
+}
 
+static
+void
+pid_free(pid_t pid)
+{
+	KASSERT(rwlock_do_i_hold_write(proc_table_lock));
+	KASSERT(pid >= __PID_MIN && pid < __PID_MAX);
+	KASSERT(pid_bitmap[pid / 32] & (1U << (pid % 32)));
 
+	pid_bitmap[pid / 32] &= ~(1U << (pid % 32));
+}
 
-#ifdef OPT_A2
-// get proc with pid
-struct proc *get_proc(pid_t pid) {
-	KASSERT(pidArray[pid] != NULL);
-	return (struct proc *)pidArray[pid];
+/*
+ * Look up a process by PID. Returns NULL if there isn't one.
+ *
+ * Nothing stops the process being destroyed once the table lock is
+ * dropped, so the caller must have some other way of keeping it
+ * alive (as _exit does by holding its parentLock), or only compare
+ * the result against NULL.
+ */
+struct proc *
+get_proc(pid_t pid)
+{
+	struct proc *proc;
+
+	if (pid < __PID_MIN || pid >= __PID_MAX) {
+		return NULL;
+	}
+
+	rwlock_acquire_read(proc_table_lock);
+	proc = proc_table[pid];
+	rwlock_release_read(proc_table_lock);
+	return proc;
 }
 
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	KASSERT(child->prevSibling == NULL && child->nextSibling == NULL);
+
+	child->nextSibling = parent->children;
+	if (parent->children != NULL) {
+		parent->children->prevSibling = child;
+	}
+	parent->children = child;
+}
 
+void
+proc_remchild(struct proc *parent, struct proc *child)
+{
+	if (child->prevSibling != NULL) {
+		child->prevSibling->nextSibling = child->nextSibling;
+	}
+	else {
+		KASSERT(parent->children == child);
+		parent->children = child->nextSibling;
+	}
+	if (child->nextSibling != NULL) {
+		child->nextSibling->prevSibling = child->prevSibling;
+	}
+	child->nextSibling = NULL;
+	child->prevSibling = NULL;
+}
+
+/*
+ * Find PARENT's child with pid PID, or NULL if it has none. Only the
+ * parent itself may call this; the children on its list can't be
+ * destroyed by anyone else.
+ */
+struct proc *
+proc_getchild(struct proc *parent, pid_t pid)
+{
+	struct proc *child;
+
+	for (child = parent->children; child != NULL;
+	     child = child->nextSibling) {
+		if (child->pid == pid) {
+			return child;
+		}
+	}
+	return NULL;
+}
 #endif
 
 
@@ -122,20 +239,39 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-#ifdef UW
-	proc->console = NULL;
-#endif // UW
+	/* File descriptors */
+	proc->p_filetable = filetable_create();
+	if (proc->p_filetable == NULL) {
+		threadarray_cleanup(&proc->p_threads);
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+
+	proc->p_ticks = 0;
+	proc->p_volswitches = 0;
+	proc->p_involswitches = 0;
+	proc->p_sleepticks = 0;
 
 #ifdef OPT_A2
-	proc->children = linkedlist_create();
-	KASSERT(proc->children != NULL);
+	proc->children = NULL;
+	proc->nextSibling = NULL;
+	proc->prevSibling = NULL;
+
+	proc->exitedHead = NULL;
+	proc->exitedTail = NULL;
+	proc->nextExited = NULL;
 
 	proc->zombie = false;
-	proc->exitCv = cv_create(name);
-	proc->exitLock = lock_create(name);
+	proc->waitCv = cv_create(name);
+	proc->waitLock = lock_create(name);
 	proc->parentLock = lock_create(name);
 	proc->exitRetval = -1;
+	proc->pid = -1;
 	proc->parentPid = 0;
+	proc->vforkAs = NULL;
+	proc->vforkSem = NULL;
 #endif
 	return proc;
 }
@@ -164,6 +300,20 @@ proc_destroy(struct proc *proc)
 	 * incorrect to destroy it.)
 	 */
 
+#if defined(UW) && defined(OPT_A2)
+	/*
+	 * Take the process out of the table first, so that nobody
+	 * going through it (see proc_foreach) finds it half gone.
+	 */
+	if (proc->pid != -1) {
+		rwlock_acquire_write(proc_table_lock);
+		KASSERT(proc_table[proc->pid] == proc);
+		proc_table[proc->pid] = NULL;
+		pid_free(proc->pid);
+		rwlock_release_write(proc_table_lock);
+	}
+#endif
+
 	/* VFS fields */
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
@@ -191,20 +341,18 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
-	if (proc->console) {
-	  vfs_close(proc->console);
+	if (proc->p_filetable) {
+		filetable_destroy(proc->p_filetable);
+		proc->p_filetable = NULL;
 	}
-#endif // UW
 
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
 #ifdef OPT_A2
-	unsigned int procid = proc->pid;
-	linkedlist_destroy(proc->children);
-	cv_destroy(proc->exitCv);
-	lock_destroy(proc->exitLock);
+	KASSERT(proc->children == NULL);
+	cv_destroy(proc->waitCv);
+	lock_destroy(proc->waitLock);
 	lock_destroy(proc->parentLock);
 #endif
 
@@ -223,18 +371,6 @@ proc_destroy(struct proc *proc)
 	if (proc_count == 0) {
 	  V(no_proc_sem);
 	}
-#ifdef OPT_A2
-	
-	//remove the proc from the proc table
-	for (unsigned int i= min_procs; i<max_procs; ++i) {
-		if (i == procid) {
-			pidArray[i] = NULL;
-			break;
-		}
-	}
-
-#endif
-
 	V(proc_count_mutex);
 #endif // UW
 	
@@ -263,9 +399,17 @@ proc_bootstrap(void)
 #endif // UW 
 
 #ifdef OPT_A2
-  for (int i=0; i<__PID_MAX; ++i) {
-  	pidArray[i] = NULL;
+  proc_table_lock = rwlock_create("proc_table_lock");
+  if (proc_table_lock == NULL) {
+    panic("could not create proc_table_lock\n");
+  }
+  /* PIDs below __PID_MIN, and any past the end, are never handed out. */
+  for (int i=0; i<PID_WORDS*32; ++i) {
+    if (i < __PID_MIN || i >= __PID_MAX) {
+      pid_bitmap[i / 32] |= 1U << (i % 32);
+    }
   }
+  pid_hint = __PID_MIN;
 #endif
 }
 
@@ -279,25 +423,17 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
-	char *console_path;
 
 	proc = proc_create(name);
 	if (proc == NULL) {
 		return NULL;
 	}
 
-#ifdef UW
-	/* open the console - this should always succeed */
-	console_path = kstrdup("con:");
-	if (console_path == NULL) {
-	  panic("unable to copy console path name during process creation\n");
-	}
-	if (vfs_open(console_path,O_WRONLY,0,&(proc->console))) {
-	  panic("unable to open the console during process creation\n");
-	}
-	kfree(console_path);
-#endif // UW
-	  
+	/*
+	 * The file table starts out empty: runprogram opens the
+	 * console in it, and fork copies the parent's.
+	 */
+
 	/* VM fields */
 
 	proc->p_addrspace = NULL;
@@ -330,16 +466,21 @@ proc_create_runprogram(const char *name)
            are created using a call to proc_create_runprogram  */
 	P(proc_count_mutex); 
 	proc_count++;
+	V(proc_count_mutex);
 #ifdef OPT_A2
-	for (unsigned int i=min_procs; i<max_procs; ++i) {
-		if (pidArray[i] == NULL) {
-			pidArray[i] = proc;
-			proc->pid = i;
-			break;
-		}
+	rwlock_acquire_write(proc_table_lock);
+	proc->pid = pid_alloc();
+	if (proc->pid != -1) {
+		KASSERT(proc_table[proc->pid] == NULL);
+		proc_table[proc->pid] = proc;
+	}
+	rwlock_release_write(proc_table_lock);
+	if (proc->pid == -1) {
+		/* Out of PIDs. This also takes it back off the count. */
+		proc_destroy(proc);
+		return NULL;
 	}
 #endif
-	V(proc_count_mutex);
 #endif // UW
 
 
@@ -387,6 +528,11 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			/* Keep its CPU usage on the books. */
+			proc->p_ticks += t->t_ticks;
+			proc->p_volswitches += t->t_volswitches;
+			proc->p_involswitches += t->t_involswitches;
+			proc->p_sleepticks += t->t_sleepticks;
 			spinlock_release(&proc->p_lock);
 			t->t_proc = NULL;
 			return;
@@ -437,3 +583,23 @@ curproc_setas(struct addrspace *newas)
 	spinlock_release(&proc->p_lock);
 	return oldas;
 }
+
+/*
+ * Call FUNC on every process.
+ */
+void
+proc_foreach(void (*func)(struct proc *, void *), void *data)
+{
+	func(kproc, data);
+
+#ifdef OPT_A2
+	/* Holding the table lock keeps processes from coming or going. */
+	rwlock_acquire_read(proc_table_lock);
+	for (int i=__PID_MIN; i<__PID_MAX; ++i) {
+		if (proc_table[i] != NULL) {
+			func(proc_table[i], data);
+		}
+	}
+	rwlock_release_read(proc_table_lock);
+#endif
+}
@@ -0,0 +1,177 @@
+/*
+ * A top-like view of where the CPU time is going. See proc_top in
+ * <proc.h>; the counters themselves are kept by thread_switch and
+ * hardclock (see <thread.h>).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <thread.h>
+#include <proc.h>
+#include <synch.h>
+#include "opt-A2.h"
+
+#define TOP_MAXPROCS	64	/* most processes we list */
+#define TOP_MAXTHREADS	128	/* most threads we list */
+#define TOP_NAMELEN	16	/* longest name kept, with the NUL */
+
+struct topentry {
+	char te_name[TOP_NAMELEN];
+	int te_pid;
+	char te_state;			/* threads only */
+	unsigned te_cpu;		/* threads only */
+	unsigned te_nthreads;		/* processes only */
+	unsigned te_ticks;
+	unsigned te_recent;
+	unsigned te_volswitches;
+	unsigned te_involswitches;
+	uint32_t te_sleepticks;
+};
+
+/* Protects the snapshot below. */
+static struct lock top_lock = LOCK_INITIALIZER(top_lock, "top_lock");
+static struct topentry top_procs[TOP_MAXPROCS];
+static struct topentry top_threads[TOP_MAXTHREADS];
+static struct topentry *top_sorted[TOP_MAXTHREADS];
+static unsigned top_nprocs, top_nthreads;
+static unsigned top_missed;		/* things that didn't fit */
+
+/* Indexed by threadstate_t: running, ready, sleeping, zombie. */
+static const char top_statechars[] = { 'R', 'r', 'S', 'Z' };
+
+/*
+ * Take down the counters of process P and its threads. Called by
+ * proc_foreach.
+ */
+static
+void
+top_collect(struct proc *p, void *data)
+{
+	struct topentry *pe, *te;
+	struct thread *t;
+	unsigned i, num;
+	int pid;
+
+	(void)data;
+
+	if (top_nprocs == TOP_MAXPROCS) {
+		top_missed++;
+		return;
+	}
+	pe = &top_procs[top_nprocs++];
+
+#if OPT_A2
+	pid = p == kproc ? 0 : p->pid;
+#else
+	pid = 0;
+#endif
+
+	spinlock_acquire(&p->p_lock);
+	snprintf(pe->te_name, sizeof(pe->te_name), "%s", p->p_name);
+	pe->te_pid = pid;
+	pe->te_state = ' ';
+	pe->te_cpu = 0;
+	pe->te_ticks = p->p_ticks;
+	pe->te_recent = 0;
+	pe->te_volswitches = p->p_volswitches;
+	pe->te_involswitches = p->p_involswitches;
+	pe->te_sleepticks = p->p_sleepticks;
+
+	num = threadarray_num(&p->p_threads);
+	pe->te_nthreads = num;
+	for (i=0; i<num; i++) {
+		t = threadarray_get(&p->p_threads, i);
+		pe->te_ticks += t->t_ticks;
+		pe->te_recent += thread_recentticks(t);
+		pe->te_volswitches += t->t_volswitches;
+		pe->te_involswitches += t->t_involswitches;
+		pe->te_sleepticks += t->t_sleepticks;
+
+		if (top_nthreads == TOP_MAXTHREADS) {
+			top_missed++;
+			continue;
+		}
+		te = &top_threads[top_nthreads++];
+		snprintf(te->te_name, sizeof(te->te_name), "%s", t->t_name);
+		te->te_pid = pid;
+		te->te_state = (unsigned)t->t_state < sizeof(top_statechars) ?
+			top_statechars[t->t_state] : '?';
+		te->te_cpu = t->t_cpu->c_number;
+		te->te_nthreads = 1;
+		te->te_ticks = t->t_ticks;
+		te->te_recent = thread_recentticks(t);
+		te->te_volswitches = t->t_volswitches;
+		te->te_involswitches = t->t_involswitches;
+		te->te_sleepticks = t->t_sleepticks;
+	}
+	spinlock_release(&p->p_lock);
+}
+
+/*
+ * Sort N entries into top_sorted, busiest first: by recent usage,
+ * then by total usage.
+ */
+static
+void
+top_sort(struct topentry *entries, unsigned n)
+{
+	struct topentry *te;
+	unsigned i, j;
+
+	for (i=0; i<n; i++) {
+		te = &entries[i];
+		for (j=i; j>0; j--) {
+			if (top_sorted[j-1]->te_recent > te->te_recent ||
+			    (top_sorted[j-1]->te_recent == te->te_recent &&
+			     top_sorted[j-1]->te_ticks >= te->te_ticks)) {
+				break;
+			}
+			top_sorted[j] = top_sorted[j-1];
+		}
+		top_sorted[j] = te;
+	}
+}
+
+void
+proc_top(unsigned topn)
+{
+	struct topentry *te;
+	unsigned i;
+
+	lock_acquire(&top_lock);
+
+	top_nprocs = top_nthreads = top_missed = 0;
+	proc_foreach(top_collect, NULL);
+
+	top_sort(top_procs, top_nprocs);
+	kprintf("%5s %-15s %4s %8s %7s %8s %8s %9s\n", "PID", "PROCESS",
+		"THR", "TICKS", "RECENT", "VOLSW", "INVOLSW", "SLEEP");
+	for (i=0; i<top_nprocs && i<topn; i++) {
+		te = top_sorted[i];
+		kprintf("%5d %-15s %4u %8u %7u %8u %8u %9u\n",
+			te->te_pid, te->te_name, te->te_nthreads,
+			te->te_ticks, te->te_recent, te->te_volswitches,
+			te->te_involswitches, te->te_sleepticks);
+	}
+
+	kprintf("\n");
+	top_sort(top_threads, top_nthreads);
+	kprintf("%5s %-15s %2s %4s %8s %7s %8s %8s %9s\n", "PID", "THREAD",
+		"ST", "CPU", "TICKS", "RECENT", "VOLSW", "INVOLSW", "SLEEP");
+	for (i=0; i<top_nthreads && i<topn; i++) {
+		te = top_sorted[i];
+		kprintf("%5d %-15s %2c %4u %8u %7u %8u %8u %9u\n",
+			te->te_pid, te->te_name, te->te_state, te->te_cpu,
+			te->te_ticks, te->te_recent, te->te_volswitches,
+			te->te_involswitches, te->te_sleepticks);
+	}
+	if (top_missed > 0) {
+		kprintf("(%u entries didn't fit)\n", top_missed);
+	}
+	kprintf("(ticks and recent in hardclocks, %d per second; "
+		"recent halves every %d ms;\n sleep in timer ticks)\n",
+		HZ, THREAD_RECENT_HALFLIFE);
+
+	lock_release(&top_lock);
+}
@@ -47,6 +47,7 @@
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <workq.h>
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -125,6 +126,8 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	workq_bootstrap();
+	kprintf_logger_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -145,6 +148,7 @@ void
 shutdown(void)
 {
 
+	kprintf_shutdown();
 	kprintf("Shutting down.\n");
 	
 	vfs_clearbootfs();
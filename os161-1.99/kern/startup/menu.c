@@ -38,6 +38,8 @@
 #include <thread.h>
 #include <proc.h>
 #include <synch.h>
+#include <lockstat.h>
+#include <trace.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
@@ -46,6 +48,8 @@
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-lockstat.h"
+#include "opt-trace.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -427,6 +431,79 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_LOCKSTAT
+/*
+ * Command for printing lock contention statistics.
+ * "lst" prints the top few locks, "lst N" the top N, and "lst reset"
+ * zeroes the counters.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	unsigned topn;
+
+	if (nargs > 2) {
+		kprintf("Usage: lst [count | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+	topn = nargs == 2 ? (unsigned)atoi(args[1]) : LOCKSTAT_DEFAULT_TOPN;
+	lockstat_print(topn);
+
+	return 0;
+}
+#endif /* OPT_LOCKSTAT */
+
+#if OPT_TRACE
+/*
+ * Command for kernel event tracing.
+ * "tr on" starts recording, discarding anything recorded before, and
+ * "tr off" stops. "tr dump [file]" stops and writes the events out,
+ * to TRACE_DEFAULT_FILE if no file is given.
+ */
+static
+int
+cmd_trace(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		return trace_start();
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		trace_stop();
+		return 0;
+	}
+	if ((nargs == 2 || nargs == 3) && !strcmp(args[1], "dump")) {
+		return trace_dump(nargs == 3 ? args[2] : TRACE_DEFAULT_FILE);
+	}
+	kprintf("Usage: tr on | off | dump [file]\n");
+	return EINVAL;
+}
+#endif /* OPT_TRACE */
+
+/*
+ * Command for a top-like view of CPU usage. "top N" shows the top N
+ * processes and threads.
+ */
+static
+int
+cmd_top(int nargs, char **args)
+{
+	unsigned topn;
+
+	if (nargs > 2) {
+		kprintf("Usage: top [count]\n");
+		return EINVAL;
+	}
+	topn = nargs == 2 ? (unsigned)atoi(args[1]) : PROC_TOP_DEFAULT_TOPN;
+	proc_top(topn);
+
+	return 0;
+}
+
 static
 int
 cmd_dbthreads(int nargs, char **args)
@@ -508,6 +585,12 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Priority inversion test       ",
+	"[sy5] Reader-writer lock test       ",
+	"[sy6] Timed wait test               ",
+	"[sy7] Lock handoff benchmark        ",
+	"[sy8] Spinlock benchmark            ",
+	"[wq]  Deferred work test            ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -548,6 +631,13 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_LOCKSTAT
+	"[lst] Lock contention stats         ",
+#endif
+#if OPT_TRACE
+	"[tr] Kernel event tracing           ",
+#endif
+	"[top] CPU usage by process/thread   ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -605,6 +695,13 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_LOCKSTAT
+	{ "lst",	cmd_lockstat },
+#endif
+#if OPT_TRACE
+	{ "tr",		cmd_trace },
+#endif
+	{ "top",	cmd_top },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -622,6 +719,12 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	pitest },
+	{ "sy5",	rwtest },
+	{ "sy6",	timedwaittest },
+	{ "sy7",	handofftest },
+	{ "sy8",	spinlockbench },
+	{ "wq",		workqtest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
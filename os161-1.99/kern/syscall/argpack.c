@@ -0,0 +1,219 @@
+/*
+ * Argument packing for execv and runprogram. See <argpack.h>.
+ *
+ * The buffer holds the argv array (argc + 1 entries, the last NULL)
+ * followed by the strings. Until argpack_copyout knows where the
+ * buffer is going, each array entry holds the offset of its string
+ * within the buffer.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <argpack.h>
+
+/* The shared ARG_MAX buffer, allocated the first time it's needed. */
+static struct lock argpack_biglock =
+	LOCK_INITIALIZER(argpack_biglock, "argpack_biglock");
+static char *argpack_bigbuf;
+
+static
+int
+argpack_init(struct argpack *ap)
+{
+	ap->ap_buf = kmalloc(ARGPACK_SMALL);
+	if (ap->ap_buf == NULL) {
+		return ENOMEM;
+	}
+	ap->ap_size = ARGPACK_SMALL;
+	ap->ap_shared = false;
+	ap->ap_len = 0;
+	ap->ap_argc = 0;
+	return 0;
+}
+
+/*
+ * Make sure the buffer has room for NEED bytes, moving the first USED
+ * bytes to the shared buffer if it doesn't.
+ */
+static
+int
+argpack_grow(struct argpack *ap, size_t need, size_t used)
+{
+	if (need <= ap->ap_size) {
+		return 0;
+	}
+	if (ap->ap_shared || need > ARG_MAX) {
+		return E2BIG;
+	}
+
+	lock_acquire(&argpack_biglock);
+	if (argpack_bigbuf == NULL) {
+		argpack_bigbuf = kmalloc(ARG_MAX);
+		if (argpack_bigbuf == NULL) {
+			lock_release(&argpack_biglock);
+			return ENOMEM;
+		}
+	}
+	memcpy(argpack_bigbuf, ap->ap_buf, used);
+	kfree(ap->ap_buf);
+	ap->ap_buf = argpack_bigbuf;
+	ap->ap_size = ARG_MAX;
+	ap->ap_shared = true;
+	return 0;
+}
+
+void
+argpack_cleanup(struct argpack *ap)
+{
+	if (ap->ap_shared) {
+		lock_release(&argpack_biglock);
+	}
+	else {
+		kfree(ap->ap_buf);
+	}
+	ap->ap_buf = NULL;
+}
+
+int
+argpack_copyin(struct argpack *ap, const_userptr_t uargv)
+{
+	vaddr_t *slots;
+	userptr_t uarg;
+	size_t pos, got;
+	int argc, i, result;
+
+	result = argpack_init(ap);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * First the user's array of pointers, which tells us how many
+	 * there are. Park the pointers in the array for now.
+	 */
+	argc = 0;
+	while (1) {
+		result = argpack_grow(ap, (argc + 1) * sizeof(vaddr_t),
+				      argc * sizeof(vaddr_t));
+		if (result) {
+			goto fail;
+		}
+		slots = (vaddr_t *)ap->ap_buf;
+		result = copyin((const_userptr_t)((vaddr_t)uargv +
+						  argc * sizeof(userptr_t)),
+				&uarg, sizeof(uarg));
+		if (result) {
+			goto fail;
+		}
+		if (uarg == NULL) {
+			break;
+		}
+		slots[argc++] = (vaddr_t)uarg;
+	}
+	slots[argc] = 0;
+	pos = (argc + 1) * sizeof(vaddr_t);
+
+	/* Then the strings, straight into place after it. */
+	for (i = 0; i < argc; i++) {
+		result = copyinstr((const_userptr_t)slots[i], ap->ap_buf + pos,
+				   ap->ap_size - pos, &got);
+		if (result == ENAMETOOLONG && !ap->ap_shared) {
+			/* Out of room; move to the big buffer and retry. */
+			result = argpack_grow(ap, ARG_MAX, pos);
+			if (result) {
+				goto fail;
+			}
+			slots = (vaddr_t *)ap->ap_buf;
+			result = copyinstr((const_userptr_t)slots[i],
+					   ap->ap_buf + pos,
+					   ap->ap_size - pos, &got);
+		}
+		if (result == ENAMETOOLONG) {
+			result = E2BIG;
+		}
+		if (result) {
+			goto fail;
+		}
+		slots[i] = pos;
+		pos += got;
+	}
+
+	ap->ap_len = pos;
+	ap->ap_argc = argc;
+	return 0;
+
+ fail:
+	argpack_cleanup(ap);
+	return result;
+}
+
+int
+argpack_kernel(struct argpack *ap, int argc, char **argv)
+{
+	vaddr_t *slots;
+	size_t pos, len;
+	int i, result;
+
+	result = argpack_init(ap);
+	if (result) {
+		return result;
+	}
+
+	/* We can see how big it is up front. */
+	pos = (argc + 1) * sizeof(vaddr_t);
+	for (i = 0; i < argc; i++) {
+		pos += strlen(argv[i]) + 1;
+	}
+	result = argpack_grow(ap, pos, 0);
+	if (result) {
+		argpack_cleanup(ap);
+		return result;
+	}
+	slots = (vaddr_t *)ap->ap_buf;
+
+	pos = (argc + 1) * sizeof(vaddr_t);
+	for (i = 0; i < argc; i++) {
+		len = strlen(argv[i]) + 1;
+		memcpy(ap->ap_buf + pos, argv[i], len);
+		slots[i] = pos;
+		pos += len;
+	}
+	slots[argc] = 0;
+
+	ap->ap_len = pos;
+	ap->ap_argc = argc;
+	return 0;
+}
+
+int
+argpack_copyout(struct argpack *ap, vaddr_t *stackptr, userptr_t *uargv)
+{
+	vaddr_t *slots;
+	vaddr_t base;
+	int i, result;
+
+	/* Keep the stack pointer 8-aligned. */
+	base = *stackptr - ROUNDUP(ap->ap_len, 8);
+
+	slots = (vaddr_t *)ap->ap_buf;
+	for (i = 0; i < ap->ap_argc; i++) {
+		slots[i] += base;
+	}
+
+	result = copyout(ap->ap_buf, (userptr_t)base, ap->ap_len);
+	if (result == EFAULT) {
+		/* The buffer's ours, so the stack wasn't big enough. */
+		result = E2BIG;
+	}
+	if (result) {
+		return result;
+	}
+
+	*stackptr = base;
+	*uargv = (userptr_t)base;
+	return 0;
+}
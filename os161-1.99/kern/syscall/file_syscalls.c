@@ -1,60 +1,518 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/iovec.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
 #include <kern/unistd.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <syscall.h>
 #include <vnode.h>
 #include <vfs.h>
+#include <copyinout.h>
 #include <current.h>
 #include <proc.h>
+#include <file.h>
+#include <pipe.h>
 
-/* handler for write() system call                  */
 /*
- * n.b.
- * This implementation handles only writes to standard output 
- * and standard error, both of which go to the console.
- * Also, it does not provide any synchronization, so writes
- * are not atomic.
+ * File system calls. Descriptors index the per-process table in
+ * curproc->p_filetable; see <file.h> for how open files are shared.
+ */
+
+/*
+ * Copy in a pathname from userspace into a fresh kernel buffer.
+ */
+static
+int
+file_copyinpath(userptr_t upath, char **ret)
+{
+  char *path;
+  int result;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(upath, path, PATH_MAX, NULL);
+  if (result) {
+    kfree(path);
+    return result;
+  }
+  *ret = path;
+  return 0;
+}
+
+/*
+ * Read or write (according to U->uio_rw) on descriptor FDESC.
  *
- * You will need to improve this implementation
+ * If POSITIONAL is false, this happens at the file's current offset,
+ * which is moved past what was transferred, and U should be set up
+ * except for uio_offset. If it's true, U->uio_offset says where, and
+ * the file's offset is left alone (pread and pwrite).
  */
+static
+int
+file_rw(int fdesc, struct uio *u, bool positional, int *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  size_t nbytes;
+  int res;
+
+  res = filetable_get(curproc->p_filetable, fdesc, &of);
+  if (res) {
+    return res;
+  }
+  if ((u->uio_rw == UIO_READ && of->of_accmode == O_WRONLY) ||
+      (u->uio_rw == UIO_WRITE && of->of_accmode == O_RDONLY)) {
+    return EBADF;
+  }
+
+  nbytes = u->uio_resid;
+
+  if (positional) {
+    /* no offset to share, so no need for the offset lock */
+    if (u->uio_offset < 0) {
+      return EINVAL;
+    }
+    res = VOP_TRYSEEK(of->of_vnode, u->uio_offset);
+    if (res) {
+      return res;
+    }
+    if (u->uio_rw == UIO_READ) {
+      res = VOP_READ(of->of_vnode, u);
+    }
+    else {
+      res = VOP_WRITE(of->of_vnode, u);
+    }
+    if (res) {
+      return res;
+    }
+    *retval = nbytes - u->uio_resid;
+    KASSERT(*retval >= 0);
+    return 0;
+  }
+
+  if (!of->of_seekable) {
+    /*
+     * Console, pipes: there's no position to keep, and reads can
+     * block indefinitely, so don't make everyone else sharing the
+     * openfile wait behind the offset lock.
+     */
+    u->uio_offset = 0;
+  }
+  else {
+    lock_acquire(of->of_offsetlock);
+    if (u->uio_rw == UIO_WRITE && of->of_append) {
+      res = VOP_STAT(of->of_vnode, &st);
+      if (res) {
+        lock_release(of->of_offsetlock);
+        return res;
+      }
+      of->of_offset = st.st_size;
+    }
+    u->uio_offset = of->of_offset;
+  }
+  if (u->uio_rw == UIO_READ) {
+    res = VOP_READ(of->of_vnode, u);
+  }
+  else {
+    res = VOP_WRITE(of->of_vnode, u);
+  }
+  if (of->of_seekable) {
+    of->of_offset = u->uio_offset;
+    lock_release(of->of_offsetlock);
+  }
+  if (res) {
+    return res;
+  }
+
+  /* pass back the number of bytes actually transferred */
+  *retval = nbytes - u->uio_resid;
+  KASSERT(*retval >= 0);
+  return 0;
+}
+
+/*
+ * Set up U and IOV for a transfer to or from the user buffer UBUF.
+ */
+static
+void
+file_uinit(struct iovec *iov, struct uio *u, userptr_t ubuf, size_t nbytes,
+	   enum uio_rw rw)
+{
+  iov->iov_ubase = ubuf;
+  iov->iov_len = nbytes;
+  u->uio_iov = iov;
+  u->uio_iovcnt = 1;
+  u->uio_offset = 0;
+  u->uio_resid = nbytes;
+  u->uio_segflg = UIO_USERSPACE;
+  u->uio_rw = rw;
+  u->uio_space = curproc->p_addrspace;
+}
+
+int
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
+{
+  struct openfile *of;
+  char *path;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: open(%x,%x,%o)\n",(unsigned int)upath,flags,mode);
+
+  res = file_copyinpath(upath, &path);
+  if (res) {
+    return res;
+  }
+  res = openfile_open(path, flags, mode, &of);
+  kfree(path);
+  if (res) {
+    return res;
+  }
+  res = filetable_place(curproc->p_filetable, of, retval);
+  if (res) {
+    openfile_decref(of);
+    return res;
+  }
+  return 0;
+}
+
+int
+sys_read(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  struct iovec iov;
+  struct uio u;
+
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+
+  KASSERT(curproc->p_addrspace != NULL);
+  file_uinit(&iov, &u, ubuf, nbytes, UIO_READ);
+  return file_rw(fdesc, &u, false, retval);
+}
 
 int
 sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
 {
   struct iovec iov;
   struct uio u;
-  int res;
 
   DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
-  
-  /* only stdout and stderr writes are currently implemented */
-  if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
-    return EUNIMP;
-  }
-  KASSERT(curproc != NULL);
-  KASSERT(curproc->console != NULL);
+
+  KASSERT(curproc->p_addrspace != NULL);
+  file_uinit(&iov, &u, ubuf, nbytes, UIO_WRITE);
+  return file_rw(fdesc, &u, false, retval);
+}
+
+int
+sys_pread(int fdesc,userptr_t ubuf,unsigned int nbytes,off_t pos,int *retval)
+{
+  struct iovec iov;
+  struct uio u;
+
+  DEBUG(DB_SYSCALL,"Syscall: pread(%d,%x,%d,%lld)\n",fdesc,(unsigned int)ubuf,nbytes,pos);
+
+  KASSERT(curproc->p_addrspace != NULL);
+  file_uinit(&iov, &u, ubuf, nbytes, UIO_READ);
+  u.uio_offset = pos;
+  return file_rw(fdesc, &u, true, retval);
+}
+
+int
+sys_pwrite(int fdesc,userptr_t ubuf,unsigned int nbytes,off_t pos,int *retval)
+{
+  struct iovec iov;
+  struct uio u;
+
+  DEBUG(DB_SYSCALL,"Syscall: pwrite(%d,%x,%d,%lld)\n",fdesc,(unsigned int)ubuf,nbytes,pos);
+
   KASSERT(curproc->p_addrspace != NULL);
+  file_uinit(&iov, &u, ubuf, nbytes, UIO_WRITE);
+  u.uio_offset = pos;
+  return file_rw(fdesc, &u, true, retval);
+}
+
+/*
+ * readv and writev: copy in the user's iovecs and hand them to the
+ * file system as one uio, so the whole transfer is one pass. A few
+ * iovecs fit on the stack; more are kmalloc'd.
+ */
+#define FILE_FASTIOV 8
 
-  /* set up a uio structure to refer to the user program's buffer (ubuf) */
-  iov.iov_ubase = ubuf;
-  iov.iov_len = nbytes;
-  u.uio_iov = &iov;
-  u.uio_iovcnt = 1;
-  u.uio_offset = 0;  /* not needed for the console */
-  u.uio_resid = nbytes;
+static
+int
+file_rwv(int fdesc, userptr_t uiov, int iovcnt, enum uio_rw rw, int *retval)
+{
+  struct iovec fastiov[FILE_FASTIOV];
+  struct iovec *iov;
+  struct uio u;
+  size_t total;
+  int i, res;
+
+  KASSERT(curproc->p_addrspace != NULL);
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    return EINVAL;
+  }
+  if (iovcnt <= FILE_FASTIOV) {
+    iov = fastiov;
+  }
+  else {
+    iov = kmalloc(iovcnt * sizeof(struct iovec));
+    if (iov == NULL) {
+      return ENOMEM;
+    }
+  }
+
+  res = copyin(uiov, iov, iovcnt * sizeof(struct iovec));
+  if (res) {
+    goto out;
+  }
+
+  /* the total has to fit in the (signed) return value */
+  total = 0;
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > (size_t)0x7fffffff - total) {
+      res = EINVAL;
+      goto out;
+    }
+    total += iov[i].iov_len;
+  }
+
+  u.uio_iov = iov;
+  u.uio_iovcnt = iovcnt;
+  u.uio_offset = 0;
+  u.uio_resid = total;
   u.uio_segflg = UIO_USERSPACE;
-  u.uio_rw = UIO_WRITE;
+  u.uio_rw = rw;
   u.uio_space = curproc->p_addrspace;
 
-  res = VOP_WRITE(curproc->console,&u);
+  res = file_rw(fdesc, &u, false, retval);
+
+ out:
+  if (iov != fastiov) {
+    kfree(iov);
+  }
+  return res;
+}
+
+int
+sys_readv(int fdesc, userptr_t uiov, int iovcnt, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: readv(%d,%x,%d)\n",fdesc,(unsigned int)uiov,iovcnt);
+
+  return file_rwv(fdesc, uiov, iovcnt, UIO_READ, retval);
+}
+
+int
+sys_writev(int fdesc, userptr_t uiov, int iovcnt, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: writev(%d,%x,%d)\n",fdesc,(unsigned int)uiov,iovcnt);
+
+  return file_rwv(fdesc, uiov, iovcnt, UIO_WRITE, retval);
+}
+
+int
+sys_lseek(int fdesc, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: lseek(%d,%lld,%d)\n",fdesc,pos,whence);
+
+  res = filetable_get(curproc->p_filetable, fdesc, &of);
   if (res) {
     return res;
   }
+  if (!of->of_seekable) {
+    /* the console, pipes, etc. */
+    return ESPIPE;
+  }
 
-  /* pass back the number of bytes actually written */
-  *retval = nbytes - u.uio_resid;
-  KASSERT(*retval >= 0);
+  lock_acquire(of->of_offsetlock);
+  switch (whence) {
+  case SEEK_SET:
+    newpos = pos;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    break;
+  case SEEK_END:
+    res = VOP_STAT(of->of_vnode, &st);
+    if (res) {
+      lock_release(of->of_offsetlock);
+      return res;
+    }
+    newpos = st.st_size + pos;
+    break;
+  default:
+    lock_release(of->of_offsetlock);
+    return EINVAL;
+  }
+  if (newpos < 0) {
+    lock_release(of->of_offsetlock);
+    return EINVAL;
+  }
+  res = VOP_TRYSEEK(of->of_vnode, newpos);
+  if (res) {
+    lock_release(of->of_offsetlock);
+    return res;
+  }
+  of->of_offset = newpos;
+  lock_release(of->of_offsetlock);
+
+  *retval = newpos;
+  return 0;
+}
+
+int
+sys_close(int fdesc)
+{
+  struct openfile *of;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: close(%d)\n",fdesc);
+
+  res = filetable_remove(curproc->p_filetable, fdesc, &of);
+  if (res) {
+    return res;
+  }
+  openfile_decref(of);
+  return 0;
+}
+
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of, *old;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: dup2(%d,%d)\n",oldfd,newfd);
+
+  res = filetable_get(curproc->p_filetable, oldfd, &of);
+  if (res) {
+    return res;
+  }
+  if (newfd < 0 || newfd >= OPEN_MAX) {
+    return EBADF;
+  }
+  if (newfd != oldfd) {
+    openfile_incref(of);
+    filetable_placeat(curproc->p_filetable, of, newfd, &old);
+    if (old != NULL) {
+      openfile_decref(old);
+    }
+  }
+  *retval = newfd;
+  return 0;
+}
+
+int
+sys_pipe(userptr_t ufds)
+{
+  struct filetable *ft = curproc->p_filetable;
+  struct vnode *rvn, *wvn;
+  struct openfile *rof, *wof, *junk;
+  int fds[2];
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: pipe(%x)\n",(unsigned int)ufds);
+
+  res = pipe_create(&rvn, &wvn);
+  if (res) {
+    return res;
+  }
+  res = openfile_create(rvn, O_RDONLY, &rof);
+  if (res) {
+    vfs_close(rvn);
+    vfs_close(wvn);
+    return res;
+  }
+  res = openfile_create(wvn, O_WRONLY, &wof);
+  if (res) {
+    openfile_decref(rof);
+    vfs_close(wvn);
+    return res;
+  }
+
+  res = filetable_place(ft, rof, &fds[0]);
+  if (res) {
+    goto fail;
+  }
+  res = filetable_place(ft, wof, &fds[1]);
+  if (res) {
+    filetable_remove(ft, fds[0], &junk);
+    goto fail;
+  }
+  res = copyout(fds, ufds, sizeof(fds));
+  if (res) {
+    filetable_remove(ft, fds[0], &junk);
+    filetable_remove(ft, fds[1], &junk);
+    goto fail;
+  }
   return 0;
+
+ fail:
+  openfile_decref(rof);
+  openfile_decref(wof);
+  return res;
+}
+
+int
+sys_fstat(int fdesc, userptr_t ustat)
+{
+  struct openfile *of;
+  struct stat st;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: fstat(%d,%x)\n",fdesc,(unsigned int)ustat);
+
+  res = filetable_get(curproc->p_filetable, fdesc, &of);
+  if (res) {
+    return res;
+  }
+  res = VOP_STAT(of->of_vnode, &st);
+  if (res) {
+    return res;
+  }
+  return copyout(&st, ustat, sizeof(st));
+}
+
+int
+sys_chdir(userptr_t upath)
+{
+  char *path;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: chdir(%x)\n",(unsigned int)upath);
+
+  res = file_copyinpath(upath, &path);
+  if (res) {
+    return res;
+  }
+  res = vfs_chdir(path);
+  kfree(path);
+  return res;
+}
+
+int
+sys_remove(userptr_t upath)
+{
+  char *path;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: remove(%x)\n",(unsigned int)upath);
+
+  res = file_copyinpath(upath, &path);
+  if (res) {
+    return res;
+  }
+  res = vfs_remove(path);
+  kfree(path);
+  return res;
 }
@@ -15,158 +15,116 @@
 #include <mips/trapframe.h>
 #include <synch.h>
 #include <vfs.h>
+#include <file.h>
 #include <kern/fcntl.h>
-#include <copyinout.h>
-
-
-int sys_execv(const char *program, char **args, int *retval) {
-  (void) args;
-  *retval = 0;
-  // Copy progam path and count arguments
-  char *progNameCopy = kstrdup(program);
-  
-  int numArgs = 0;
-  char *wordArgs = args[0];
-  int j = 0;
-  while (wordArgs) {
-    ++numArgs;
-    ++j;
-    wordArgs = args[j];
-  }
-
-  j = 0;
-  wordArgs = args[0];
-  char *vargs[numArgs];
-  while (wordArgs) {
-    vargs[j] = kstrdup(wordArgs);
-    ++j;
-    wordArgs = args[j];
+#include <argpack.h>
+#include <limits.h>
+
+
+/*
+ * A vfork child is done with its parent's address space (it has
+ * exec'd or is exiting): let the parent carry on.
+ */
+static void vfork_release(struct proc *p) {
+  struct semaphore *sem = p->vforkSem;
+
+  if (sem != NULL) {
+    p->vforkAs = NULL;
+    p->vforkSem = NULL;
+    // the parent destroys sem once it wakes, so don't touch it after this
+    V(sem);
   }
+}
 
-  // kprintf("In exec v. Process %d. Program Path %s. Num Args %d \n", curproc->pid, progNameCopy, numArgs);
-  
 
+int sys_execv(userptr_t uprogram, userptr_t uargv) {
+  struct argpack args;
+  struct addrspace *as, *oldAddrSpace;
   struct vnode *v;
-  int vfsOpenResult;
+  vaddr_t entrypoint, stackptr;
+  userptr_t argvPointer;
+  char *progname;
+  int argc, result;
+
+  // Copy in the program path and the arguments while we can still see them
+  progname = kmalloc(PATH_MAX);
+  if (progname == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(uprogram, progname, PATH_MAX, NULL);
+  if (result) {
+    kfree(progname);
+    return result;
+  }
+  result = argpack_copyin(&args, uargv);
+  if (result) {
+    kfree(progname);
+    return result;
+  }
 
   /* Open the file. */
-  vfsOpenResult = vfs_open(progNameCopy, O_RDONLY, 0, &v);
-  if (vfsOpenResult) {
-    *retval = vfsOpenResult;
-    return -1;
+  result = vfs_open(progname, O_RDONLY, 0, &v);
+  kfree(progname);
+  if (result) {
+    argpack_cleanup(&args);
+    return result;
   }
 
   /* Create a new address space. */
-  struct addrspace *as = as_create();
+  as = as_create();
   if (as == NULL) {
     vfs_close(v);
-    *retval = ENOMEM;
-    return -1;
+    argpack_cleanup(&args);
+    return ENOMEM;
   }
 
-  vaddr_t entrypoint = 0; 
-  vaddr_t stackptr = 0;
-
   /* Switch to it and activate it. */
-  struct addrspace *oldAddrSpace = curproc_setas(as);
+  oldAddrSpace = curproc_setas(as);
   as_activate();
 
   /* Load the executable. */
-  int vfsLoadElfResult;
-  vfsLoadElfResult = load_elf(v, &entrypoint);
-  if (vfsLoadElfResult) {
-    vfs_close(v);
-    *retval = vfsLoadElfResult;
-    return -1;
+  result = load_elf(v, &entrypoint);
+  /* Done with the file now. */
+  vfs_close(v);
+  if (result) {
+    goto fail;
   }
 
   /* Define the user stack in the address space */
-  int defineStackResult = as_define_stack(as, &stackptr);
-  if (defineStackResult) {
-    vfs_close(v);
-    *retval = defineStackResult;
-    return -1;
-  }
-
-  // kprintf("Stack start at %x\n", stackptr);
-  int added = 0;
-  
-  char *curWord = vargs[0];
-  int i = 0;
-  vaddr_t userWordAddresses[numArgs + 1];
-  // Copy all the strings to user stack
-  while (curWord) {
-    size_t wordLen = strlen(curWord) + 1;
-    // kprintf("Copy out word arg: %s, size %x\n", curWord, wordLen);
-    stackptr -= wordLen;
-    added += wordLen;
-    int wordCopyResult = copyout(curWord, (userptr_t)stackptr, wordLen);
-    if (wordCopyResult) {
-      *retval = wordCopyResult;
-      return -1;
-    }
-    userWordAddresses[i] = stackptr;
-    ++i;
-    
-    // kprintf("Stack remaining: %x\n", stackptr);
-    curWord = vargs[i];
+  result = as_define_stack(as, &stackptr);
+  if (result) {
+    goto fail;
   }
 
-  // Prepare null end to argv array
-  userWordAddresses[numArgs] = 0;
-
-  // Align for character pointers
-  stackptr -= (ROUNDUP(added, 4) - added);
-  added += (ROUNDUP(added, 4) - added);
-  // kprintf("Stack remaining after align: %x\n", stackptr);
-
-  // Copy userstack string ptrs to user stack
-  for (int j=numArgs; j>=0; --j) {
-    // kprintf("Copy out word arg pointer: %x, size %x\n", userWordAddresses[j], sizeof(char *));
-    stackptr -= sizeof(char *);
-    added += sizeof(char *);
-    int wordCopyResult = copyout(&userWordAddresses[j], (userptr_t)stackptr, sizeof(char *));
-    if (wordCopyResult) {
-      *retval = wordCopyResult;
-      return -1;
-    }
-    
-    // kprintf("Stack remaining: %x\n", stackptr);
-    
+  // Lay out argv and the strings on the new stack in one go
+  result = argpack_copyout(&args, &stackptr, &argvPointer);
+  if (result) {
+    goto fail;
   }
+  argc = args.ap_argc;
+  argpack_cleanup(&args);
 
-  vaddr_t userArgvPointer = stackptr;
-  // vaddr_t userArgvPointer = stackptr;
-
-  // int argvCopyResult = copyout(&userArgvPointerValue, (userptr_t)stackptr, sizeof(char **));
-  // kprintf("Copy out argv pointer: %x, size %x\n", userArgvPointerValue,  sizeof(char **));
-  // if (argvCopyResult) {
-  //   *retval = argvCopyResult;
-  //   return -1;
-  // }
-  // stackptr -= sizeof(char **);
-  // kprintf("Stack remaining: %x\n", stackptr);
-  // added += sizeof(char *);
-
-  stackptr -= (ROUNDUP(added, 8) - added);
-  // kprintf("Stack remaining after align: %x\n", stackptr);
-
-  kfree(oldAddrSpace);
-  /* Done with the file now. */
-  vfs_close(v);
-  kfree(progNameCopy);
-  for (int j=0; j<numArgs; ++j) {
-    kfree(vargs[j]);
+  if (oldAddrSpace == curproc->vforkAs) {
+    // it was our vfork parent's; give it back instead of freeing it
+    vfork_release(curproc);
+  } else {
+    as_destroy(oldAddrSpace);
   }
 
   /* Warp to user mode. */
-  // kprintf("userArgvPointer value: %x\n", userArgvPointer);
-  enter_new_process(numArgs, (userptr_t)userArgvPointer,
-        stackptr, entrypoint);
+  enter_new_process(argc, argvPointer, stackptr, entrypoint);
   
   /* enter_new_process does not return. */
   panic("enter_new_process returned\n");
   return EINVAL;
+
+ fail:
+  // the old image is untouched, so go back to it
+  curproc_setas(oldAddrSpace);
+  as_activate();
+  as_destroy(as);
+  argpack_cleanup(&args);
+  return result;
 }
 
 
@@ -223,6 +181,9 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
   // know your daddy
   child->parentPid = curproc->pid;
 
+  // share our open files
+  filetable_copy(curproc->p_filetable, child->p_filetable);
+
   int tforkerr = thread_fork("fork process thread", child, thread_fork_entry, tfcopy, 0);
   if (tforkerr != 0) {
     *retval = -1;
@@ -230,9 +191,75 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
   }
 
   *retval = child->pid;
-  bool addChild = linkedlist_add(curproc->children, child->pid);
-  KASSERT(addChild);
+  proc_addchild(curproc, child);
+
+  return 0;
+}
+
+
+/*
+ * vfork: like fork, but the child runs in our address space instead of
+ * a copy, and we wait until it execs or exits. That skips as_copy,
+ * which is most of the cost of fork, for the usual case of a fork
+ * followed straight away by execv.
+ */
+int sys_vfork(struct trapframe *tf, pid_t *retval) {
+  struct semaphore *done = sem_create("vfork", 0);
+  if (done == NULL) {
+    return ENOMEM;
+  }
+
+  // child name
+  char *curpname = curproc->p_name;
+  char *childpname = kmalloc(strlen(curpname) + sizeof("_child"));
+  if (childpname == NULL) {
+    sem_destroy(done);
+    return ENOMEM;
+  }
+  strcpy(childpname, curpname);
+  strcat(childpname, "_child");
+
+  struct proc *child = proc_create_runprogram(childpname);
+  kfree(childpname);
+  if (child == NULL) {
+    sem_destroy(done);
+    return ENOMEM;
+  }
+
+  // lend the child our address space
+  spinlock_acquire(&(child->p_lock));
+  child->p_addrspace = curproc->p_addrspace;
+  spinlock_release(&(child->p_lock));
+  child->vforkAs = curproc->p_addrspace;
+  child->vforkSem = done;
+
+  struct trapframe *tfcopy = kmalloc(sizeof(struct trapframe));
+  if (tfcopy == NULL) {
+    child->p_addrspace = NULL;
+    proc_destroy(child);
+    sem_destroy(done);
+    return ENOMEM;
+  }
+  memcpy(tfcopy, tf, sizeof(struct trapframe));
+
+  child->parentPid = curproc->pid;
+  filetable_copy(curproc->p_filetable, child->p_filetable);
+
+  int tforkerr = thread_fork("vfork process thread", child, thread_fork_entry, tfcopy, 0);
+  if (tforkerr != 0) {
+    kfree(tfcopy);
+    child->p_addrspace = NULL;
+    proc_destroy(child);
+    sem_destroy(done);
+    return tforkerr;
+  }
+
+  *retval = child->pid;
+  proc_addchild(curproc, child);
 
+  // wait for our address space back
+  P(done);
+  sem_destroy(done);
   return 0;
 }
 
@@ -258,41 +285,45 @@ void sys__exit(int exitcode) {
    * messily fatal.
    */
   as = curproc_setas(NULL);
-  as_destroy(as);
+  if (as == p->vforkAs) {
+    // still borrowing our vfork parent's; hand it back
+    vfork_release(p);
+  } else {
+    as_destroy(as);
+  }
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
   // kprintf("\nDestroying process: %s\n", curproc->p_name);
   proc_remthread(curthread);
 
-  // this removes any zombie children 
-  struct linkedlist *children = p->children;
-  struct llnode *cur = children->head;
-  struct llnode *prev = NULL;
-  while (cur != NULL) {
-    struct proc *curChild = get_proc(cur->data);
+  // close our files now rather than when we're reaped
+  filetable_closeall(p->p_filetable);
 
+  // this removes any zombie children and orphans the rest, emptying the
+  // list in one pass
+  struct proc *curChild = p->children;
+  p->children = NULL;
+  while (curChild != NULL) {
+    struct proc *nextChild = curChild->nextSibling;
     struct lock *curparentLock = curChild->parentLock;
 
+    curChild->nextSibling = NULL;
+    curChild->prevSibling = NULL;
+
     lock_acquire(curparentLock);
-    if (prev == NULL && curChild->zombie) {
-      children->head = cur->next;
-      lock_release(curparentLock);
-      proc_destroy(curChild);
-      cur = children->head;
-    } else if (curChild->zombie) {
-      prev->next = cur->next;
+    if (curChild->zombie) {
       lock_release(curparentLock);
       proc_destroy(curChild);
-      cur = prev->next;
     } else {
       curChild->parentPid = -1;
-      prev = cur;
-      cur = cur->next;
       lock_release(curparentLock);
     }
-    
+    curChild = nextChild;
   }
+  // whatever was on our exited queue was a zombie, and is gone now
+  p->exitedHead = NULL;
+  p->exitedTail = NULL;
 
   struct lock *parentLock = p->parentLock;
 
@@ -302,17 +333,25 @@ void sys__exit(int exitcode) {
     lock_release(parentLock);
     proc_destroy(p);
   } else {
-    //otherwise, become a zombie
-    struct lock *exitlock = p->exitLock;
-    struct cv *exitcv = p->exitCv;
-    
-    lock_acquire(exitlock);
+    // otherwise, become a zombie on our parent's exited queue. The
+    // parent can't go away while we hold parentLock, since its _exit
+    // takes it to orphan us.
+    struct proc *parent = get_proc(p->parentPid);
+    KASSERT(parent != NULL);
+
+    lock_acquire(parent->waitLock);
     p->zombie = true;
     p->exitRetval = _MKWAIT_EXIT(exitcode);
-    cv_signal(exitcv, exitlock);
+    if (parent->exitedTail == NULL) {
+      parent->exitedHead = p;
+    } else {
+      parent->exitedTail->nextExited = p;
+    }
+    parent->exitedTail = p;
+    cv_signal(parent->waitCv, parent->waitLock);
+    lock_release(parent->waitLock);
 
     lock_release(parentLock);
-    lock_release(exitlock);
   }
 
   thread_exit();
@@ -329,41 +368,84 @@ sys_getpid(pid_t *retval)
   return(0);
 }
 
-/* stub handler for waitpid() system call                */
+/*
+ * Take CHILD off P's queue of exited children. Usually it's the
+ * first; otherwise this is linear in the number of exited children
+ * ahead of it. Called with P's waitLock held.
+ */
+static void exited_remove(struct proc *p, struct proc *child) {
+  struct proc **pp = &p->exitedHead;
+  struct proc *prev = NULL;
+
+  while (*pp != child) {
+    KASSERT(*pp != NULL);
+    prev = *pp;
+    pp = &prev->nextExited;
+  }
+  *pp = child->nextExited;
+  if (p->exitedTail == child) {
+    p->exitedTail = prev;
+  }
+  child->nextExited = NULL;
+}
 
+/*
+ * waitpid: PID is a child to wait for, or -1 for whichever child
+ * exits first. With WNOHANG, return 0 instead of waiting if there's
+ * nothing to reap yet.
+ */
 int
 sys_waitpid(pid_t pid,
       userptr_t status,
       int options,
       pid_t *retval)
 {
+  struct proc *p = curproc;
+  struct proc *child;
   int exitstatus;
   int result;
 
-  if (options != 0) {
+  if (options & ~WNOHANG) {
     return(EINVAL);
   }
 
-  // if child not dead then wait until it is
-  struct proc *child = get_proc(pid);
-  struct linkedlist *children = curproc->children;
+  if (pid == -1) {
+    if (p->children == NULL) {
+      return(ECHILD);
+    }
+    child = NULL;
+  } else {
+    // look in our own list: some other process's child could be
+    // reaped and destroyed under us
+    child = proc_getchild(p, pid);
+    if (child == NULL) {
+      return(get_proc(pid) == NULL ? ESRCH : ECHILD);
+    }
+  }
 
-  lock_acquire(child->exitLock);
-  
-  if (!(child->zombie)) {
-    cv_wait(child->exitCv, child->exitLock);
+  // wait until the child (or any child) is on our exited queue
+  lock_acquire(p->waitLock);
+  while (child == NULL ? p->exitedHead == NULL : !child->zombie) {
+    if (options & WNOHANG) {
+      lock_release(p->waitLock);
+      *retval = 0;
+      return(0);
+    }
+    cv_wait(p->waitCv, p->waitLock);
   }
+  if (child == NULL) {
+    child = p->exitedHead;
+  }
+  exited_remove(p, child);
 
   exitstatus = child->exitRetval;
-  // kprintf("EXIT STATUS: %d", exitstatus);
   KASSERT(exitstatus != -1);
-
-  lock_release(child->exitLock);
+  lock_release(p->waitLock);
 
   //destroy child after
+  pid = child->pid;
+  proc_remchild(p, child);
   proc_destroy(child);
-  bool removeChild = linkedlist_remove(children, pid);
-  KASSERT(removeChild);
 
 
   result = copyout((void *)&exitstatus,status,sizeof(int));
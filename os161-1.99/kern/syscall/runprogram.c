@@ -42,12 +42,13 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <vfs.h>
+#include <file.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-A2.h"
 
 #if OPT_A2
-#include <copyinout.h>
+#include <argpack.h>
 #endif
 
 /*
@@ -68,6 +69,10 @@ runprogram(char *progname)
 	struct vnode *v;
 	vaddr_t entrypoint, stackptr;
 	int result;
+#if OPT_A2
+	struct argpack argpack;
+	userptr_t argv;
+#endif
 
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
@@ -78,6 +83,13 @@ runprogram(char *progname)
 	/* We should be a new process. */
 	KASSERT(curproc_getas() == NULL);
 
+	/* Set up stdin, stdout, and stderr. */
+	result = filetable_openconsole(curproc->p_filetable);
+	if (result) {
+		vfs_close(v);
+		return result;
+	}
+
 	/* Create a new address space. */
 	as = as_create();
 	if (as ==NULL) {
@@ -109,61 +121,19 @@ runprogram(char *progname)
 
 
 #if OPT_A2
+	/* Lay out argv and the strings on the stack in one go. */
+	result = argpack_kernel(&argpack, nargs, args);
+	if (result) {
+		return result;
+	}
+	result = argpack_copyout(&argpack, &stackptr, &argv);
+	argpack_cleanup(&argpack);
+	if (result) {
+		return result;
+	}
 
-  // kprintf("Stack start at %x\n", stackptr);
-  int added = 0;
-  
-  char *curWord = args[0];
-  int i = 0;
-  vaddr_t userWordAddresses[nargs + 1];
-  // Copy all the strings to user stack
-  while (curWord) {
-    size_t wordLen = strlen(curWord) + 1;
-    // kprintf("Copy out word arg: %s, size %x\n", curWord, wordLen);
-    stackptr -= wordLen;
-    added += wordLen;
-    int wordCopyResult = copyout(curWord, (userptr_t)stackptr, wordLen);
-    if (wordCopyResult) {
-      return wordCopyResult;
-    }
-    userWordAddresses[i] = stackptr;
-    ++i;
-    
-    // kprintf("Stack remaining: %x\n", stackptr);
-    curWord = args[i];
-  }
-
-  // Prepare null end to argv array
-  userWordAddresses[nargs] = 0;
-
-  // Align for character pointers
-  stackptr -= (ROUNDUP(added, 4) - added);
-  added += (ROUNDUP(added, 4) - added);
-  // kprintf("Stack remaining after align: %x\n", stackptr);
-
-  // Copy userstack string ptrs to user stack
-  for (int j=nargs; j>=0; --j) {
-    // kprintf("Copy out word arg pointer: %x, size %x\n", userWordAddresses[j], sizeof(char *));
-    stackptr -= sizeof(char *);
-    added += sizeof(char *);
-    int wordCopyResult = copyout(&userWordAddresses[j], (userptr_t)stackptr, sizeof(char *));
-    if (wordCopyResult) {
-      return wordCopyResult;
-    }
-    
-    // kprintf("Stack remaining: %x\n", stackptr);
-    
-  }
-
-  vaddr_t userArgvPointer = stackptr;
-
-  stackptr -= (ROUNDUP(added, 8) - added);
-  // kprintf("Stack remaining after align: %x\n", stackptr);
-
-  /* Warp to user mode. */
-  // kprintf("userArgvPointer value: %x\n", userArgvPointer);
-  enter_new_process(nargs, (userptr_t)userArgvPointer,
-        stackptr, entrypoint);
+	/* Warp to user mode. */
+	enter_new_process(nargs, argv, stackptr, entrypoint);
 #else
 	/* Warp to user mode. */
 	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
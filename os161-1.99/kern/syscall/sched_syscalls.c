@@ -0,0 +1,31 @@
+/*
+ * Scheduling-related system calls.
+ */
+
+#include <types.h>
+#include <copyinout.h>
+#include <current.h>
+#include <thread.h>
+#include <syscall.h>
+
+/*
+ * Set the CPUs the calling process may run on. Bits for CPUs that
+ * don't exist are ignored; if none are left, fail with EINVAL.
+ */
+int
+sys_setaffinity(uint32_t mask)
+{
+	return thread_setaffinity(mask);
+}
+
+/*
+ * Get the calling process's CPU mask, trimmed to the CPUs that exist.
+ */
+int
+sys_getaffinity(userptr_t user_mask_ptr)
+{
+	uint32_t mask;
+
+	mask = curthread->t_affinity & thread_cpumask();
+	return copyout(&mask, user_mask_ptr, sizeof(mask));
+}
@@ -32,11 +32,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
+#include <current.h>
 #include <synch.h>
 #include <test.h>
+#include <lamebus/ltimer.h>	/* for LT_GRANULARITY */
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
@@ -347,3 +351,811 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock test.
+ *
+ * Readers and writers take turns at testval1..3 as in the lock test.
+ * Writers check that nobody else is in with them; readers check that
+ * the values don't change under them, and we count how many readers
+ * manage to be in at once. Then check writer preference: with a
+ * reader in and a writer waiting, a newly arriving reader must wait
+ * until the writer has had its turn.
+ */
+
+#define NRWLOOPS	40
+
+static struct rwlock *testrw;
+static struct spinlock rw_statelock = SPINLOCK_INITIALIZER;
+static unsigned rw_readersin;
+static unsigned rw_writersin;
+static unsigned rw_maxreaders;
+static volatile bool rw_overlapped;
+static volatile bool rw_failed;
+static volatile bool rw_writerdone;
+static volatile bool rw_readersawwriter;
+
+static
+void
+rw_enter(bool writer)
+{
+	spinlock_acquire(&rw_statelock);
+	if (writer) {
+		rw_writersin++;
+		if (rw_writersin != 1 || rw_readersin != 0) {
+			rw_overlapped = true;
+		}
+	}
+	else {
+		rw_readersin++;
+		if (rw_writersin != 0) {
+			rw_overlapped = true;
+		}
+		if (rw_readersin > rw_maxreaders) {
+			rw_maxreaders = rw_readersin;
+		}
+	}
+	spinlock_release(&rw_statelock);
+}
+
+static
+void
+rw_leave(bool writer)
+{
+	spinlock_acquire(&rw_statelock);
+	if (writer) {
+		rw_writersin--;
+	}
+	else {
+		rw_readersin--;
+	}
+	spinlock_release(&rw_statelock);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	unsigned long v1, v2, v3;
+	int i;
+	bool writer;
+
+	(void)junk;
+
+	/* One thread in four is a writer. */
+	writer = (num % 4 == 0);
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (writer) {
+			rwlock_acquire_write(testrw);
+			rw_enter(true);
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+			testval3 = num%3;
+			if (testval1 != num || testval2 != num*num ||
+			    testval3 != num%3) {
+				kprintf("thread %lu: values changed while "
+					"writing\n", num);
+				rw_failed = true;
+			}
+			rw_leave(true);
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			rw_enter(false);
+			v1 = testval1;
+			v2 = testval2;
+			v3 = testval3;
+			thread_yield();
+			if (testval1 != v1 || testval2 != v2 ||
+			    testval3 != v3) {
+				kprintf("thread %lu: values changed while "
+					"reading\n", num);
+				rw_failed = true;
+			}
+			rw_leave(false);
+			rwlock_release_read(testrw);
+		}
+	}
+	V(donesem);
+}
+
+static
+void
+rwprefwriter(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_write(testrw);
+	rw_writerdone = true;
+	rwlock_release_write(testrw);
+	V(donesem);
+}
+
+static
+void
+rwprefreader(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_read(testrw);
+	rw_readersawwriter = rw_writerdone;
+	rwlock_release_read(testrw);
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	rw_readersin = rw_writersin = rw_maxreaders = 0;
+	rw_overlapped = false;
+	rw_failed = false;
+
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	kprintf("Up to %u readers held the lock at once\n", rw_maxreaders);
+	if (rw_overlapped) {
+		kprintf("A writer held the lock along with someone else\n");
+		rw_failed = true;
+	}
+	if (rw_maxreaders < 2) {
+		kprintf("Readers never shared the lock\n");
+		rw_failed = true;
+	}
+
+	/* Writer preference. */
+	rw_writerdone = false;
+	rw_readersawwriter = false;
+	rwlock_acquire_read(testrw);
+	result = thread_fork("rwprefwriter", NULL, rwprefwriter, NULL, 0);
+	if (result) {
+		panic("rwtest: thread_fork failed: %s\n", strerror(result));
+	}
+	/* Give the writer time to queue up. */
+	clocksleep(1);
+	result = thread_fork("rwprefreader", NULL, rwprefreader, NULL, 0);
+	if (result) {
+		panic("rwtest: thread_fork failed: %s\n", strerror(result));
+	}
+	clocksleep(1);
+	if (rw_writerdone) {
+		kprintf("Writer got in while a reader held the lock\n");
+		rw_failed = true;
+	}
+	rwlock_release_read(testrw);
+	P(donesem);
+	P(donesem);
+	if (!rw_readersawwriter) {
+		kprintf("Late reader got in ahead of a waiting writer\n");
+		rw_failed = true;
+	}
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+	if (rw_failed) {
+		kprintf("Test failed\n");
+	}
+#ifdef UW
+	cleanitems();
+#endif
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+/*
+ * Timed wait test.
+ *
+ * P_timed and cv_timedwait with nobody to wake them must time out,
+ * and not too early; with a waker they must not. lock_tryacquire must
+ * fail on a lock another thread holds and succeed on a free one.
+ */
+
+#define TW_TIMEOUT_MS	200
+
+static
+void
+twwaker(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	if (num == 0) {
+		V(testsem);
+	}
+	else {
+		lock_acquire(testlock);
+		cv_signal(testcv, testlock);
+		lock_release(testlock);
+	}
+	V(donesem);
+}
+
+static
+void
+twholder(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	lock_acquire(testlock);
+	V(donesem);
+	P(testsem);
+	lock_release(testlock);
+	V(donesem);
+}
+
+static
+uint32_t
+tw_elapsed_ms(uint32_t start)
+{
+	return (clock_ticks() - start) * (LT_GRANULARITY / 1000);
+}
+
+int
+timedwaittest(int nargs, char **args)
+{
+	uint32_t start, ms;
+	int result;
+	bool failed = false;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting timed wait test...\n");
+
+	/* testsem starts at 2; use it up. */
+	P(testsem);
+	P(testsem);
+
+	start = clock_ticks();
+	result = P_timed(testsem, TW_TIMEOUT_MS);
+	ms = tw_elapsed_ms(start);
+	kprintf("P_timed with no V: %s after %u ms\n",
+		result ? strerror(result) : "succeeded", ms);
+	if (result != ETIMEDOUT || ms < TW_TIMEOUT_MS) {
+		failed = true;
+	}
+
+	result = thread_fork("twwaker", NULL, twwaker, NULL, 0);
+	if (result) {
+		panic("timedwaittest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	result = P_timed(testsem, TW_TIMEOUT_MS * 10);
+	P(donesem);
+	kprintf("P_timed with V: %s\n",
+		result ? strerror(result) : "succeeded");
+	if (result != 0) {
+		failed = true;
+	}
+
+	lock_acquire(testlock);
+	start = clock_ticks();
+	result = cv_timedwait(testcv, testlock, TW_TIMEOUT_MS);
+	ms = tw_elapsed_ms(start);
+	kprintf("cv_timedwait with no signal: %s after %u ms\n",
+		result ? strerror(result) : "succeeded", ms);
+	if (result != ETIMEDOUT || ms < TW_TIMEOUT_MS ||
+	    !lock_do_i_hold(testlock)) {
+		failed = true;
+	}
+
+	result = thread_fork("twwaker", NULL, twwaker, NULL, 1);
+	if (result) {
+		panic("timedwaittest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	result = cv_timedwait(testcv, testlock, TW_TIMEOUT_MS * 10);
+	lock_release(testlock);
+	P(donesem);
+	kprintf("cv_timedwait with signal: %s\n",
+		result ? strerror(result) : "succeeded");
+	if (result != 0) {
+		failed = true;
+	}
+
+	result = thread_fork("twholder", NULL, twholder, NULL, 0);
+	if (result) {
+		panic("timedwaittest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	P(donesem);
+	if (lock_tryacquire(testlock)) {
+		kprintf("lock_tryacquire got a held lock\n");
+		lock_release(testlock);
+		failed = true;
+	}
+	V(testsem);
+	P(donesem);
+	if (!lock_tryacquire(testlock)) {
+		kprintf("lock_tryacquire failed on a free lock\n");
+		failed = true;
+	}
+	else {
+		lock_release(testlock);
+	}
+
+	/* so we can run it again */
+	V(testsem);
+	V(testsem);
+
+	if (failed) {
+		kprintf("Test failed\n");
+	}
+#ifdef UW
+	cleanitems();
+#endif
+	kprintf("Timed wait test done.\n");
+
+	return 0;
+}
+
+/*
+ * Priority inversion test.
+ *
+ * A low-priority thread takes lock A and then does a long stretch of
+ * work. A medium-priority thread takes lock B and waits for A. A
+ * high-priority thread then waits for B, while a crowd of hogs, more
+ * important than the low thread but less than the high one, eat all
+ * the CPU they can get.
+ *
+ * Without priority inheritance the low thread never runs while the
+ * hogs do, so the high thread waits until they give up. With it, the
+ * high thread's priority passes through the medium thread to the low
+ * thread, which finishes its work ahead of the hogs, and the high
+ * thread gets B after a bounded delay.
+ */
+
+#define PI_NHOGS	4
+#define PI_HOGLOOPS	2000	/* how long the hogs hog */
+#define PI_SPIN		20000	/* busywork per hog iteration */
+#define PI_WORK		200000	/* busywork done by the low thread */
+
+static struct lock *pi_locka;
+static struct lock *pi_lockb;
+static struct semaphore *pi_sem;
+static volatile bool pi_highdone;
+static volatile unsigned pi_hogprogress;
+static volatile unsigned pi_highwait;
+
+static
+void
+pi_busywork(unsigned n)
+{
+	volatile unsigned i;
+
+	for (i=0; i<n; i++);
+}
+
+static
+void
+pi_lowthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(PRI_MIN);
+	lock_acquire(pi_locka);
+	V(pi_sem);
+	pi_busywork(PI_WORK);
+	lock_release(pi_locka);
+	V(donesem);
+}
+
+static
+void
+pi_midthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(PRI_DEFAULT);
+	lock_acquire(pi_lockb);
+	V(pi_sem);
+	lock_acquire(pi_locka);
+	lock_release(pi_locka);
+	lock_release(pi_lockb);
+	V(donesem);
+}
+
+static
+void
+pi_highthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(PRI_MAX);
+	lock_acquire(pi_lockb);
+	pi_highwait = pi_hogprogress;
+	pi_highdone = true;
+	lock_release(pi_lockb);
+	V(donesem);
+}
+
+static
+void
+pi_hogthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(PRI_MAX - 1);
+	for (i=0; i<PI_HOGLOOPS && !pi_highdone; i++) {
+		pi_busywork(PI_SPIN);
+		pi_hogprogress++;
+	}
+	V(donesem);
+}
+
+static
+void
+pi_fork(const char *name, void (*func)(void *, unsigned long),
+	unsigned long num)
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, num);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+pitest(int nargs, char **args)
+{
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	pi_locka = lock_create("pi_locka");
+	pi_lockb = lock_create("pi_lockb");
+	pi_sem = sem_create("pi_sem", 0);
+	if (pi_locka == NULL || pi_lockb == NULL || pi_sem == NULL) {
+		panic("pitest: out of memory\n");
+	}
+	pi_highdone = false;
+	pi_hogprogress = 0;
+	pi_highwait = 0;
+
+	kprintf("Starting priority inversion test...\n");
+
+	/* Stay ahead of the hogs while setting up. */
+	thread_setpriority(PRI_MAX);
+
+	pi_fork("pi_low", pi_lowthread, 0);
+	P(pi_sem);
+	pi_fork("pi_mid", pi_midthread, 0);
+	P(pi_sem);
+	for (i=0; i<PI_NHOGS; i++) {
+		pi_fork("pi_hog", pi_hogthread, i);
+	}
+	pi_fork("pi_high", pi_highthread, 0);
+
+	thread_setpriority(PRI_DEFAULT);
+	for (i=0; i<PI_NHOGS + 3; i++) {
+		P(donesem);
+	}
+
+	kprintf("High-priority thread waited through %u of %u hog "
+		"iterations\n", pi_highwait, PI_NHOGS * PI_HOGLOOPS);
+	if (pi_highwait < PI_NHOGS * PI_HOGLOOPS) {
+		kprintf("Priority inversion was bounded.\n");
+	}
+	else {
+		kprintf("Test failed: high-priority thread waited for "
+			"the hogs\n");
+	}
+
+	sem_destroy(pi_sem);
+	lock_destroy(pi_lockb);
+	lock_destroy(pi_locka);
+#ifdef UW
+	cleanitems();
+#endif
+	kprintf("Priority inversion test done.\n");
+
+	return 0;
+}
+
+/*
+ * Handoff benchmark.
+ *
+ * A crowd of threads take turns at a lock (or binary semaphore),
+ * holding it briefly and coming straight back for it. We time every
+ * acquire and report the spread of waits, with and without handoff
+ * mode. Without it, a thread that has just released the lock usually
+ * gets it back before the waiter it woke has run, so some waits are
+ * very long; with it the waits should be much more even, at the cost
+ * of more context switches and a longer total time.
+ */
+
+#define HO_NTHREADS	8
+#define HO_NLOOPS	200
+#define HO_HOLD		500	/* busywork with the lock held */
+#define HO_THINK	100	/* busywork between acquires */
+
+static struct lock *ho_lock;
+static struct semaphore *ho_sem;
+static bool ho_usesem;
+static uint32_t ho_waits[HO_NTHREADS * HO_NLOOPS];
+
+static
+void
+ho_thread(void *junk, unsigned long num)
+{
+	uint32_t start;
+	unsigned i;
+
+	(void)junk;
+
+	for (i=0; i<HO_NLOOPS; i++) {
+		start = cpu_getcycles();
+		if (ho_usesem) {
+			P(ho_sem);
+		}
+		else {
+			lock_acquire(ho_lock);
+		}
+		ho_waits[num * HO_NLOOPS + i] = cpu_getcycles() - start;
+		pi_busywork(HO_HOLD);
+		if (ho_usesem) {
+			V(ho_sem);
+		}
+		else {
+			lock_release(ho_lock);
+		}
+		pi_busywork(HO_THINK);
+	}
+	V(donesem);
+}
+
+static
+void
+ho_run(bool usesem, bool handoff)
+{
+	uint32_t start, elapsed, wait;
+	uint64_t total;
+	unsigned i, j, n;
+	int result;
+
+	ho_usesem = usesem;
+	lock_sethandoff(ho_lock, handoff);
+	sem_sethandoff(ho_sem, handoff);
+
+	start = cpu_getcycles();
+	for (i=0; i<HO_NTHREADS; i++) {
+		result = thread_fork("ho_thread", NULL, ho_thread, NULL, i);
+		if (result) {
+			panic("handofftest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<HO_NTHREADS; i++) {
+		P(donesem);
+	}
+	elapsed = cpu_getcycles() - start;
+
+	/* Insertion sort, to find the percentiles. */
+	n = HO_NTHREADS * HO_NLOOPS;
+	total = 0;
+	for (i=0; i<n; i++) {
+		wait = ho_waits[i];
+		total += wait;
+		for (j=i; j>0 && ho_waits[j-1] > wait; j--) {
+			ho_waits[j] = ho_waits[j-1];
+		}
+		ho_waits[j] = wait;
+	}
+
+	kprintf("%-5s %-8s %10u %10u %10u %10u %12u\n",
+		usesem ? "sem" : "lock", handoff ? "handoff" : "barging",
+		(unsigned)(total / n), ho_waits[n / 2],
+		ho_waits[n * 99 / 100], ho_waits[n - 1], elapsed);
+}
+
+int
+handofftest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	ho_lock = lock_create("ho_lock");
+	ho_sem = sem_create("ho_sem", 1);
+	if (ho_lock == NULL || ho_sem == NULL) {
+		panic("handofftest: out of memory\n");
+	}
+
+	kprintf("Starting handoff benchmark (%d threads, %d acquires "
+		"each)...\n", HO_NTHREADS, HO_NLOOPS);
+	kprintf("%-5s %-8s %10s %10s %10s %10s %12s\n", "kind", "mode",
+		"mean wait", "median", "99th %ile", "max", "total");
+	ho_run(false, false);
+	ho_run(false, true);
+	ho_run(true, false);
+	ho_run(true, true);
+	kprintf("(all times in cycles)\n");
+
+	sem_destroy(ho_sem);
+	lock_destroy(ho_lock);
+#ifdef UW
+	cleanitems();
+#endif
+	kprintf("Handoff benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Spinlock benchmark.
+ *
+ * Several threads hammer one spinlock, first as a test-and-set lock
+ * and then as a ticket lock, timing each acquire and counting how
+ * many acquires each CPU got. The ticket lock should even out the
+ * counts and cut the worst-case wait. This is only interesting with
+ * more than one CPU (see ncpus in sys161.conf); on one CPU the lock
+ * is never contended.
+ */
+
+#define SB_NTHREADS	8
+#define SB_NLOOPS	2000
+#define SB_HOLD		50	/* busywork with the lock held */
+#define SB_THINK	20	/* busywork between acquires */
+#define SB_MAXCPUS	32
+
+static struct spinlock sb_lock;
+static struct spinlock sb_statlock = SPINLOCK_INITIALIZER;
+static unsigned sb_percpu[SB_MAXCPUS];
+static uint64_t sb_totalwait;
+static uint32_t sb_maxwait;
+
+static
+void
+sb_thread(void *junk, unsigned long num)
+{
+	uint32_t start, wait, maxwait;
+	uint64_t totalwait;
+	unsigned i, cpunum;
+
+	(void)junk;
+	(void)num;
+
+	maxwait = 0;
+	totalwait = 0;
+	for (i=0; i<SB_NLOOPS; i++) {
+		start = cpu_getcycles();
+		spinlock_acquire(&sb_lock);
+		wait = cpu_getcycles() - start;
+		/* Can't migrate while holding a spinlock. */
+		cpunum = curcpu->c_number;
+		if (cpunum < SB_MAXCPUS) {
+			sb_percpu[cpunum]++;
+		}
+		pi_busywork(SB_HOLD);
+		spinlock_release(&sb_lock);
+
+		totalwait += wait;
+		if (wait > maxwait) {
+			maxwait = wait;
+		}
+		pi_busywork(SB_THINK);
+	}
+
+	spinlock_acquire(&sb_statlock);
+	sb_totalwait += totalwait;
+	if (maxwait > sb_maxwait) {
+		sb_maxwait = maxwait;
+	}
+	spinlock_release(&sb_statlock);
+	V(donesem);
+}
+
+static
+void
+sb_run(bool ticket)
+{
+	uint32_t start, elapsed;
+	unsigned i, ncpus, mincount, maxcount;
+	int result;
+
+	spinlock_init(&sb_lock);
+	if (ticket) {
+		spinlock_setticket(&sb_lock);
+	}
+	for (i=0; i<SB_MAXCPUS; i++) {
+		sb_percpu[i] = 0;
+	}
+	sb_totalwait = 0;
+	sb_maxwait = 0;
+
+	start = cpu_getcycles();
+	for (i=0; i<SB_NTHREADS; i++) {
+		result = thread_fork("sb_thread", NULL, sb_thread, NULL, i);
+		if (result) {
+			panic("spinlockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<SB_NTHREADS; i++) {
+		P(donesem);
+	}
+	elapsed = cpu_getcycles() - start;
+	spinlock_cleanup(&sb_lock);
+
+	ncpus = 0;
+	mincount = SB_NTHREADS * SB_NLOOPS;
+	maxcount = 0;
+	for (i=0; i<SB_MAXCPUS; i++) {
+		if (sb_percpu[i] == 0) {
+			continue;
+		}
+		ncpus++;
+		if (sb_percpu[i] < mincount) {
+			mincount = sb_percpu[i];
+		}
+		if (sb_percpu[i] > maxcount) {
+			maxcount = sb_percpu[i];
+		}
+	}
+
+	kprintf("%-6s %5u %10u %10u %10u %10u %12u\n",
+		ticket ? "ticket" : "tas", ncpus,
+		mincount, maxcount,
+		(unsigned)(sb_totalwait / (SB_NTHREADS * SB_NLOOPS)),
+		sb_maxwait, elapsed);
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	inititems();
+
+	kprintf("Starting spinlock benchmark (%d threads, %d acquires "
+		"each)...\n", SB_NTHREADS, SB_NLOOPS);
+	kprintf("%-6s %5s %10s %10s %10s %10s %12s\n", "kind", "cpus",
+		"min/cpu", "max/cpu", "mean wait", "max wait", "total");
+	sb_run(false);
+	sb_run(true);
+	kprintf("(all times in cycles)\n");
+
+#ifdef UW
+	cleanitems();
+#endif
+	kprintf("Spinlock benchmark done.\n");
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Deferred work test: runs items as soft work and on sys_workqueue,
+ * and reports how long soft work waits to be run.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <workq.h>
+#include <test.h>
+
+#define WQ_NSOFT	100	/* soft work rounds */
+#define WQ_NWORK	32	/* items for the worker threads */
+
+static struct semaphore *wq_donesem;
+static struct lock *wq_lock;
+static volatile unsigned wq_count;
+static volatile uint32_t wq_stamp;
+static volatile uint64_t wq_latency;
+
+static
+void
+wq_softfunc(void *arg)
+{
+	(void)arg;
+
+	/* Soft work runs in interrupt context... */
+	KASSERT(curthread->t_in_interrupt);
+	wq_latency += cpu_getcycles() - wq_stamp;
+	wq_count++;
+	V(wq_donesem);
+}
+
+static
+void
+wq_workfunc(void *arg)
+{
+	(void)arg;
+
+	/* ...and worker items don't, so they can sleep. */
+	KASSERT(!curthread->t_in_interrupt);
+	lock_acquire(wq_lock);
+	wq_count++;
+	lock_release(wq_lock);
+	V(wq_donesem);
+}
+
+static
+void
+wq_softtest(void)
+{
+	struct work w;
+	bool first, second;
+	unsigned i;
+	int s;
+
+	work_init(&w, wq_softfunc, NULL);
+	wq_count = 0;
+	wq_latency = 0;
+
+	/* Scheduling twice before it runs only queues it once. */
+	s = splhigh();
+	wq_stamp = cpu_getcycles();
+	first = softwork_schedule(&w);
+	second = softwork_schedule(&w);
+	splx(s);
+	P(wq_donesem);
+	if (!first || second) {
+		kprintf("wq: soft work scheduled twice\n");
+		panic("wq: test failed\n");
+	}
+
+	for (i = 1; i < WQ_NSOFT; i++) {
+		wq_stamp = cpu_getcycles();
+		softwork_schedule(&w);
+		P(wq_donesem);
+	}
+	KASSERT(wq_count == WQ_NSOFT);
+
+	kprintf("wq: %u soft work runs, mean latency %u cycles\n",
+		WQ_NSOFT, (unsigned)(wq_latency / WQ_NSOFT));
+}
+
+static
+void
+wq_queuetest(void)
+{
+	struct work *works;
+	unsigned i;
+
+	works = kmalloc(WQ_NWORK * sizeof(*works));
+	if (works == NULL) {
+		panic("wq: Out of memory\n");
+	}
+	wq_count = 0;
+
+	for (i = 0; i < WQ_NWORK; i++) {
+		work_init(&works[i], wq_workfunc, NULL);
+		workqueue_enqueue(sys_workqueue, &works[i]);
+	}
+	for (i = 0; i < WQ_NWORK; i++) {
+		P(wq_donesem);
+	}
+	KASSERT(wq_count == WQ_NWORK);
+	kfree(works);
+
+	kprintf("wq: %u items run on sys_workqueue\n", WQ_NWORK);
+}
+
+int
+workqtest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	wq_donesem = sem_create("wq_donesem", 0);
+	wq_lock = lock_create("wq_lock");
+	if (wq_donesem == NULL || wq_lock == NULL) {
+		panic("wq: Out of memory\n");
+	}
+
+	kprintf("Starting deferred work test...\n");
+	wq_softtest();
+	wq_queuetest();
+	kprintf("Deferred work test done.\n");
+
+	lock_destroy(wq_lock);
+	sem_destroy(wq_donesem);
+	return 0;
+}
@@ -0,0 +1,5 @@
+/* Make sure to build out-of-line versions of the atomic functions */
+#define ATOMIC_INLINE	/* empty */
+
+#include <types.h>
+#include <atomic.h>
@@ -30,6 +30,7 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
@@ -73,6 +74,25 @@ static struct wchan *minibolt;
  */
 static int minicount;
 
+/*
+ * Timer ticks since boot. Only the CPU that runs timerclock changes
+ * it.
+ */
+static volatile uint32_t ticks;
+
+/*
+ * Pending callouts, in order of the tick they fire at.
+ */
+static struct callout *callouts;
+static struct spinlock callout_lock = SPINLOCK_INITIALIZER;
+
+/* Callout states */
+#define CO_IDLE		0
+#define CO_PENDING	1
+#define CO_RUNNING	2
+
+static void callout_run(void);
+
 /*
  * Setup.
  */
@@ -99,6 +119,9 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
+	ticks++;
+	callout_run();
+
 	/* Broadcast on minibolt */
 	wchan_wakeall(minibolt);
 	/* Broadcast on lbolt if a second has elapsed */
@@ -120,13 +143,17 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	thread_accounttick();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	if (!curcpu->c_softrunning) {
+		/* Don't switch away from under soft work; see workq.c */
+		thread_yield();
+	}
 }
 
 /*
@@ -155,3 +182,107 @@ clocknap(int num_ticks)
     num_ticks--;
   }
 }
+
+/*
+ * Timer ticks.
+ */
+uint32_t
+clock_ticks(void)
+{
+	return ticks;
+}
+
+uint32_t
+clock_mstoticks(unsigned ms)
+{
+	const unsigned ms_per_tick = LT_GRANULARITY / 1000;
+
+	return (ms + ms_per_tick - 1) / ms_per_tick;
+}
+
+/*
+ * Callouts.
+ */
+void
+callout_init(struct callout *co, void (*func)(void *), void *arg)
+{
+	co->co_next = NULL;
+	co->co_when = 0;
+	co->co_func = func;
+	co->co_arg = arg;
+	co->co_state = CO_IDLE;
+}
+
+void
+callout_schedule(struct callout *co, uint32_t when)
+{
+	struct callout **cop;
+
+	spinlock_acquire(&callout_lock);
+	KASSERT(co->co_state != CO_PENDING);
+	co->co_when = when;
+	co->co_state = CO_PENDING;
+	for (cop = &callouts; *cop != NULL; cop = &(*cop)->co_next) {
+		if (clock_tick_before(when, (*cop)->co_when)) {
+			break;
+		}
+	}
+	co->co_next = *cop;
+	*cop = co;
+	spinlock_release(&callout_lock);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	struct callout **cop;
+	bool waspending;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&callout_lock);
+	while (co->co_state == CO_RUNNING) {
+		/* It's running on the timer CPU and won't be long. */
+		spinlock_release(&callout_lock);
+		spinlock_acquire(&callout_lock);
+	}
+	waspending = co->co_state == CO_PENDING;
+	if (waspending) {
+		for (cop = &callouts; *cop != co; cop = &(*cop)->co_next) {
+			KASSERT(*cop != NULL);
+		}
+		*cop = co->co_next;
+		co->co_next = NULL;
+		co->co_state = CO_IDLE;
+	}
+	spinlock_release(&callout_lock);
+	return waspending;
+}
+
+/*
+ * Fire any callouts that are due. Called from timerclock.
+ */
+static
+void
+callout_run(void)
+{
+	struct callout *co;
+
+	spinlock_acquire(&callout_lock);
+	while (callouts != NULL && !clock_tick_before(ticks, callouts->co_when)) {
+		co = callouts;
+		callouts = co->co_next;
+		co->co_next = NULL;
+		co->co_state = CO_RUNNING;
+
+		spinlock_release(&callout_lock);
+		co->co_func(co->co_arg);
+		spinlock_acquire(&callout_lock);
+
+		/* It may have been rescheduled by its own function. */
+		if (co->co_state == CO_RUNNING) {
+			co->co_state = CO_IDLE;
+		}
+	}
+	spinlock_release(&callout_lock);
+}
@@ -0,0 +1,422 @@
+/*
+ * Lock contention statistics. See <lockstat.h>.
+ *
+ * The hooks here are called from inside spinlock_acquire and
+ * spinlock_release, so they must not use spinlocks themselves, or
+ * anything that does (kmalloc, kprintf, ...). Instead each entry,
+ * and the table as a whole, is protected by a bare spinlock word.
+ * The hooks are always called with interrupts off, because the
+ * caller is holding a spinlock.
+ *
+ * Entries are never removed, so looking one up doesn't need the table
+ * lock: an entry is filled in before it's marked in use, and its key
+ * never changes after that. Only adding an entry takes the table lock.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_NENTRIES	256	/* size of the table */
+#define LOCKSTAT_NAMELEN	24	/* longest name kept, with the NUL */
+
+/* Kinds of entry */
+#define LS_SPINLOCK	0
+#define LS_LOCK		1
+#define LS_WCHAN	2
+
+static const char *const lockstat_kinds[] = { "spin", "lock", "wchan" };
+
+struct lockstat {
+	volatile bool ls_used;		/* entry is filled in */
+	volatile spinlock_data_t ls_lock; /* protects the counters */
+	int ls_kind;			/* LS_* */
+	const void *ls_site;		/* call site, for unnamed spinlocks */
+	char ls_name[LOCKSTAT_NAMELEN];	/* name, for everything else */
+
+	unsigned ls_acquires;		/* times acquired */
+	unsigned ls_contended;		/* times found already held */
+	unsigned ls_spins;		/* trips round a spin loop */
+	unsigned ls_spinhits;		/* ...that got the lock (locks only) */
+	unsigned ls_sleeps;		/* times a thread slept */
+	unsigned ls_holds;		/* holds timed */
+	uint64_t ls_holdcycles;		/* total cycles held */
+};
+
+static struct lockstat lockstat_table[LOCKSTAT_NENTRIES];
+static volatile spinlock_data_t lockstat_tablelock = SPINLOCK_DATA_INITIALIZER;
+
+/* Where things go once the table is full. */
+static struct lockstat lockstat_overflow = {
+	.ls_used = true,
+	.ls_lock = SPINLOCK_DATA_INITIALIZER,
+	.ls_kind = LS_SPINLOCK,
+	.ls_name = "(table full)",
+};
+
+/* For lockstat_print; protects the snapshot below. */
+static struct lock lockstat_printlock =
+	LOCK_INITIALIZER(lockstat_printlock, "lockstat_printlock");
+static struct lockstat lockstat_snapshot[LOCKSTAT_NENTRIES + 1];
+static struct lockstat *lockstat_sorted[LOCKSTAT_NENTRIES + 1];
+
+////////////////////////////////////////////////////////////
+// Table
+
+static
+void
+lockstat_rawlock(volatile spinlock_data_t *sd)
+{
+	while (spinlock_data_get(sd) != 0 ||
+	       spinlock_data_testandset(sd) != 0) {
+		/* spin */
+	}
+}
+
+static
+void
+lockstat_rawunlock(volatile spinlock_data_t *sd)
+{
+	spinlock_data_set(sd, 0);
+}
+
+static
+unsigned
+lockstat_hash(int kind, const char *name, const void *site)
+{
+	unsigned h;
+	size_t i;
+
+	h = kind;
+	if (name == NULL) {
+		return h + ((uintptr_t)site >> 2);
+	}
+	for (i = 0; i < LOCKSTAT_NAMELEN - 1 && name[i] != 0; i++) {
+		h = h * 31 + (unsigned char)name[i];
+	}
+	return h;
+}
+
+/*
+ * Compare NAME with an entry's name, as far as we keep it. (There's
+ * no strncmp in the kernel.)
+ */
+static
+bool
+lockstat_samename(const char *entryname, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < LOCKSTAT_NAMELEN - 1; i++) {
+		if (entryname[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			break;
+		}
+	}
+	return true;
+}
+
+static
+bool
+lockstat_match(struct lockstat *ls, int kind, const char *name,
+	       const void *site)
+{
+	if (ls->ls_kind != kind) {
+		return false;
+	}
+	if (name == NULL) {
+		return ls->ls_site == site;
+	}
+	return ls->ls_site == NULL && lockstat_samename(ls->ls_name, name);
+}
+
+/*
+ * Find the entry for NAME (or, if NAME is NULL, for SITE) of the
+ * given kind, adding it if it isn't there yet.
+ */
+static
+struct lockstat *
+lockstat_lookup(int kind, const char *name, const void *site)
+{
+	struct lockstat *ls;
+	unsigned h, i;
+	bool locked;
+
+	h = lockstat_hash(kind, name, site);
+	locked = false;
+
+ again:
+	for (i = 0; i < LOCKSTAT_NENTRIES; i++) {
+		ls = &lockstat_table[(h + i) % LOCKSTAT_NENTRIES];
+		if (!ls->ls_used) {
+			break;
+		}
+		if (lockstat_match(ls, kind, name, site)) {
+			if (locked) {
+				lockstat_rawunlock(&lockstat_tablelock);
+			}
+			return ls;
+		}
+	}
+
+	if (!locked) {
+		/* Look again with the table locked, in case of a race. */
+		lockstat_rawlock(&lockstat_tablelock);
+		locked = true;
+		goto again;
+	}
+
+	if (i == LOCKSTAT_NENTRIES) {
+		ls = &lockstat_overflow;
+	}
+	else {
+		ls->ls_kind = kind;
+		ls->ls_site = name == NULL ? site : NULL;
+		if (name != NULL) {
+			snprintf(ls->ls_name, sizeof(ls->ls_name), "%s", name);
+		}
+		spinlock_data_set(&ls->ls_lock, 0);
+		ls->ls_used = true;
+	}
+	lockstat_rawunlock(&lockstat_tablelock);
+	return ls;
+}
+
+static
+void
+lockstat_count(struct lockstat *ls, bool contended, unsigned spins,
+	       unsigned spinhits, unsigned sleeps)
+{
+	lockstat_rawlock(&ls->ls_lock);
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+	}
+	ls->ls_spins += spins;
+	ls->ls_spinhits += spinhits;
+	ls->ls_sleeps += sleeps;
+	lockstat_rawunlock(&ls->ls_lock);
+}
+
+static
+void
+lockstat_addhold(struct lockstat *ls, uint32_t since)
+{
+	uint32_t now;
+
+	now = cpu_getcycles();
+	lockstat_rawlock(&ls->ls_lock);
+	ls->ls_holds++;
+	ls->ls_holdcycles += now - since;
+	lockstat_rawunlock(&ls->ls_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Hooks
+
+void
+lockstat_spinlock_acquired(struct spinlock *lk, unsigned spins,
+			   const void *site)
+{
+	struct lockstat *ls;
+
+	if (lk->lk_name == NULL) {
+		ls = lockstat_lookup(LS_SPINLOCK, NULL, site);
+	}
+	else {
+		if (lk->lk_stat == NULL) {
+			lk->lk_stat = lockstat_lookup(LS_SPINLOCK,
+						      lk->lk_name, NULL);
+		}
+		ls = lk->lk_stat;
+	}
+	lockstat_count(ls, spins > 0, spins, 0, 0);
+	lk->lk_holdstat = ls;
+	lk->lk_acqtime = cpu_getcycles();
+}
+
+void
+lockstat_spinlock_release(struct spinlock *lk)
+{
+	if (lk->lk_holdstat != NULL) {
+		lockstat_addhold(lk->lk_holdstat, lk->lk_acqtime);
+		lk->lk_holdstat = NULL;
+	}
+}
+
+void
+lockstat_lock_acquired(struct lock *lk, bool contended, unsigned spins,
+		       unsigned spinhits, unsigned sleeps)
+{
+	if (lk->lk_stat == NULL) {
+		lk->lk_stat = lockstat_lookup(LS_LOCK, lk->lk_name, NULL);
+	}
+	lockstat_count(lk->lk_stat, contended, spins, spinhits, sleeps);
+	lk->lk_acqtime = cpu_getcycles();
+	lk->lk_acqcpu = curcpu->c_self;
+}
+
+void
+lockstat_lock_release(struct lock *lk)
+{
+	KASSERT(lk->lk_stat != NULL);
+	/*
+	 * The holder may have slept and woken up on another CPU, whose
+	 * cycle counter has nothing to do with this one's. Spinlock
+	 * holders can't move, so they always count.
+	 */
+	if (lk->lk_acqcpu == curcpu->c_self) {
+		lockstat_addhold(lk->lk_stat, lk->lk_acqtime);
+	}
+}
+
+void
+lockstat_wchan_sleep(struct wchan *wc)
+{
+	struct lockstat *ls;
+
+	ls = lockstat_lookup(LS_WCHAN,
+			     wc->wc_name != NULL ? wc->wc_name : "(unnamed)",
+			     NULL);
+	lockstat_rawlock(&ls->ls_lock);
+	ls->ls_sleeps++;
+	lockstat_rawunlock(&ls->ls_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Reporting
+
+/*
+ * Order for the table: most contended first, then by sleeps, then by
+ * number of acquires.
+ */
+static
+bool
+lockstat_before(struct lockstat *a, struct lockstat *b)
+{
+	if (a->ls_contended != b->ls_contended) {
+		return a->ls_contended > b->ls_contended;
+	}
+	if (a->ls_sleeps != b->ls_sleeps) {
+		return a->ls_sleeps > b->ls_sleeps;
+	}
+	return a->ls_acquires > b->ls_acquires;
+}
+
+/*
+ * Copy an entry's counters out with its lock held, so we can print
+ * without holding anything; printing takes spinlocks of its own.
+ */
+static
+void
+lockstat_copy(struct lockstat *to, struct lockstat *from)
+{
+	int s;
+
+	s = splhigh();
+	lockstat_rawlock(&from->ls_lock);
+	*to = *from;
+	lockstat_rawunlock(&from->ls_lock);
+	splx(s);
+}
+
+void
+lockstat_print(unsigned topn)
+{
+	struct lockstat *ls;
+	unsigned i, j, n, spins, hits;
+	char sitename[LOCKSTAT_NAMELEN];
+
+	lock_acquire(&lockstat_printlock);
+
+	n = 0;
+	for (i = 0; i < LOCKSTAT_NENTRIES; i++) {
+		if (lockstat_table[i].ls_used) {
+			lockstat_copy(&lockstat_snapshot[n++],
+				      &lockstat_table[i]);
+		}
+	}
+	lockstat_copy(&lockstat_snapshot[n++], &lockstat_overflow);
+
+	/* Insertion sort; the table is small. */
+	for (i = 0; i < n; i++) {
+		ls = &lockstat_snapshot[i];
+		for (j = i; j > 0 && lockstat_before(ls, lockstat_sorted[j-1]);
+		     j--) {
+			lockstat_sorted[j] = lockstat_sorted[j-1];
+		}
+		lockstat_sorted[j] = ls;
+	}
+
+	kprintf("Lock statistics (top %u of %u):\n", topn < n ? topn : n, n);
+	kprintf("%-5s %-23s %9s %9s %10s %8s %10s\n", "kind", "name",
+		"acquires", "contended", "spins", "sleeps", "avg hold");
+	for (i = 0; i < n && i < topn; i++) {
+		ls = lockstat_sorted[i];
+		if (ls->ls_site != NULL) {
+			snprintf(sitename, sizeof(sitename), "at %p",
+				 ls->ls_site);
+		}
+		kprintf("%-5s %-23s %9u %9u %10u %8u %10u\n",
+			lockstat_kinds[ls->ls_kind],
+			ls->ls_site != NULL ? sitename : ls->ls_name,
+			ls->ls_acquires, ls->ls_contended, ls->ls_spins,
+			ls->ls_sleeps,
+			ls->ls_holds == 0 ? 0 :
+			(unsigned)(ls->ls_holdcycles / ls->ls_holds));
+	}
+	kprintf("(hold times in cycles)\n");
+
+	/* How well adaptive spinning in lock_acquire is doing. */
+	spins = hits = 0;
+	for (i = 0; i < n; i++) {
+		if (lockstat_snapshot[i].ls_kind == LS_LOCK) {
+			spins += lockstat_snapshot[i].ls_spins;
+			hits += lockstat_snapshot[i].ls_spinhits;
+		}
+	}
+	kprintf("Locks: spun %u times, got the lock %u times (%u%%)\n",
+		spins, hits, spins == 0 ? 0 : hits * 100 / spins);
+
+	lock_release(&lockstat_printlock);
+}
+
+static
+void
+lockstat_zero(struct lockstat *ls)
+{
+	int s;
+
+	s = splhigh();
+	lockstat_rawlock(&ls->ls_lock);
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_spins = 0;
+	ls->ls_spinhits = 0;
+	ls->ls_sleeps = 0;
+	ls->ls_holds = 0;
+	ls->ls_holdcycles = 0;
+	lockstat_rawunlock(&ls->ls_lock);
+	splx(s);
+}
+
+void
+lockstat_reset(void)
+{
+	unsigned i;
+
+	for (i = 0; i < LOCKSTAT_NENTRIES; i++) {
+		if (lockstat_table[i].ls_used) {
+			lockstat_zero(&lockstat_table[i]);
+		}
+	}
+	lockstat_zero(&lockstat_overflow);
+}
@@ -35,6 +35,8 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <atomic.h>
+#include <lockstat.h>
 #include <current.h>	/* for curcpu */
 
 /*
@@ -50,6 +52,41 @@ spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
 	lk->lk_holder = NULL;
+	lk->lk_ticket = false;
+	lk->lk_nextticket = 0;
+	lk->lk_nowserving = 0;
+#if OPT_LOCKSTAT
+	lk->lk_name = NULL;
+	lk->lk_stat = NULL;
+	lk->lk_holdstat = NULL;
+	lk->lk_acqtime = 0;
+#endif
+}
+
+/*
+ * Name spinlock, for lock statistics.
+ */
+void
+spinlock_setname(struct spinlock *lk, const char *name)
+{
+#if OPT_LOCKSTAT
+	lk->lk_name = name;
+	lk->lk_stat = NULL;
+#else
+	(void)lk;
+	(void)name;
+#endif
+}
+
+/*
+ * Make spinlock a ticket lock.
+ */
+void
+spinlock_setticket(struct spinlock *lk)
+{
+	KASSERT(lk->lk_holder == NULL);
+	KASSERT(lk->lk_nextticket == lk->lk_nowserving);
+	lk->lk_ticket = true;
 }
 
 /*
@@ -60,6 +97,7 @@ spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
 	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(lk->lk_nextticket == lk->lk_nowserving);
 }
 
 /*
@@ -73,6 +111,7 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	unsigned spins, ticket;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +126,44 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
+	spins = 0;
+	if (lk->lk_ticket) {
 		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
+		 * Take a ticket and wait for our number to come up.
+		 * Only the holder writes lk_nowserving, so waiting
+		 * is just reading.
 		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+		ticket = atomic_fetchadd(&lk->lk_nextticket, 1);
+		while (lk->lk_nowserving != ticket) {
+			spins++;
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+	}
+	else {
+		while (1) {
+			/*
+			 * Do test-test-and-set, that is, read first before
+			 * doing test-and-set, to reduce bus contention.
+			 *
+			 * Test-and-set is a machine-level atomic operation
+			 * that writes 1 into the lock word and returns the
+			 * previous value. If that value was 0, the lock was
+			 * previously unheld and we now own it. If it was 1,
+			 * we don't.
+			 */
+			if (spinlock_data_get(&lk->lk_lock) != 0) {
+				spins++;
+				continue;
+			}
+			if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+				spins++;
+				continue;
+			}
+			break;
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+	lockstat_spinlock_acquired(lk, spins, __builtin_return_address(0));
 }
 
 /*
@@ -121,8 +177,15 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+	lockstat_spinlock_release(lk);
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	if (lk->lk_ticket) {
+		/* Serve the next in line. */
+		lk->lk_nowserving++;
+	}
+	else {
+		spinlock_data_set(&lk->lk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
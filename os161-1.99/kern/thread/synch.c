@@ -33,12 +33,38 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
+#include <trace.h>
+
+/*
+ * Allocate SIZE bytes for a synchronization object with a copy of
+ * NAME tacked on the end, so the whole thing is one allocation. The
+ * copy is returned in *RETNAME.
+ */
+static
+void *
+synch_alloc(size_t size, const char *name, const char **retname)
+{
+        char *obj;
+        size_t len;
+
+        len = strlen(name) + 1;
+        obj = kmalloc(size + len);
+        if (obj == NULL) {
+                return NULL;
+        }
+        memcpy(obj + size, name, len);
+        *retname = obj + size;
+        return obj;
+}
 
 ////////////////////////////////////////////////////////////
 //
@@ -48,29 +74,21 @@ struct semaphore *
 sem_create(const char *name, int initial_count)
 {
         struct semaphore *sem;
+        const char *copy;
 
         KASSERT(initial_count >= 0);
 
-        sem = kmalloc(sizeof(struct semaphore));
+        sem = synch_alloc(sizeof(struct semaphore), name, &copy);
         if (sem == NULL) {
                 return NULL;
         }
 
-        sem->sem_name = kstrdup(name);
-        if (sem->sem_name == NULL) {
-                kfree(sem);
-                return NULL;
-        }
-
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
-		return NULL;
-	}
+        sem->sem_name = copy;
 
+	wchan_init(&sem->sem_wchan, sem->sem_name);
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+        sem->sem_handoff = false;
 
         return sem;
 }
@@ -82,11 +100,36 @@ sem_destroy(struct semaphore *sem)
 
 	/* wchan_cleanup will assert if anyone's waiting on it */
 	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
-        kfree(sem->sem_name);
+	wchan_cleanup(&sem->sem_wchan);
         kfree(sem);
 }
 
+void
+sem_sethandoff(struct semaphore *sem, bool handoff)
+{
+	spinlock_acquire(&sem->sem_lock);
+        sem->sem_handoff = handoff;
+	spinlock_release(&sem->sem_lock);
+}
+
+/*
+ * Check, after waking up, whether V handed us the count directly. If
+ * so we own it and must not decrement sem_count. Call with sem_lock
+ * held.
+ */
+static
+bool
+sem_takehandoff(struct semaphore *sem)
+{
+        KASSERT(spinlock_do_i_hold(&sem->sem_lock));
+
+        if (curthread->t_handoff != sem) {
+                return false;
+        }
+        curthread->t_handoff = NULL;
+        return true;
+}
+
 void 
 P(struct semaphore *sem)
 {
@@ -108,37 +151,91 @@ P(struct semaphore *sem)
 		 * through on the wchan until we've finished going to
 		 * sleep. Note that wchan_sleep unlocks the wchan.
 		 *
-		 * Note that we don't maintain strict FIFO ordering of
-		 * threads going through the semaphore; that is, we
-		 * might "get" it on the first try even if other
-		 * threads are waiting. Apparently according to some
-		 * textbooks semaphores must for some reason have
-		 * strict ordering. Too bad. :-)
-		 *
-		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * Note that unless the semaphore is in handoff mode
+		 * we don't maintain strict FIFO ordering of threads
+		 * going through the semaphore; that is, we might
+		 * "get" it on the first try even if other threads are
+		 * waiting. In handoff mode V never raises the count
+		 * while anyone is waiting, so we can't.
 		 */
-		wchan_lock(sem->sem_wchan);
+		wchan_lock(&sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
-                wchan_sleep(sem->sem_wchan);
+                wchan_sleep(&sem->sem_wchan);
 
 		spinlock_acquire(&sem->sem_lock);
+                if (sem_takehandoff(sem)) {
+                        spinlock_release(&sem->sem_lock);
+                        return;
+                }
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+P_timed(struct semaphore *sem, unsigned timeout_ms)
+{
+        uint32_t deadline;
+        int result;
+
+        KASSERT(sem != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        deadline = clock_ticks() + clock_mstoticks(timeout_ms);
+
+	spinlock_acquire(&sem->sem_lock);
+        while (sem->sem_count == 0) {
+		/* As in P, but give up at the deadline. */
+		wchan_lock(&sem->sem_wchan);
+		spinlock_release(&sem->sem_lock);
+                result = wchan_timedsleep(&sem->sem_wchan, deadline);
+
+		spinlock_acquire(&sem->sem_lock);
+                if (sem_takehandoff(sem)) {
+                        spinlock_release(&sem->sem_lock);
+                        return 0;
+                }
+                if (result && sem->sem_count == 0) {
+                        spinlock_release(&sem->sem_lock);
+                        return result;
+                }
+        }
+        KASSERT(sem->sem_count > 0);
+        sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+        return 0;
+}
+
 void
 V(struct semaphore *sem)
 {
+        struct thread *next;
+
         KASSERT(sem != NULL);
 
 	spinlock_acquire(&sem->sem_lock);
 
-        sem->sem_count++;
-        KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+        if (sem->sem_handoff) {
+                /*
+                 * Give the count to the first waiter, if any. It
+                 * can't look at t_handoff until we let go of
+                 * sem_lock, so it's safe to set it after the wakeup.
+                 */
+                next = wchan_wakeone(&sem->sem_wchan);
+                if (next != NULL) {
+                        next->t_handoff = sem;
+                }
+                else {
+                        sem->sem_count++;
+                        KASSERT(sem->sem_count > 0);
+                }
+        }
+        else {
+                sem->sem_count++;
+                KASSERT(sem->sem_count > 0);
+                wchan_wakeone(&sem->sem_wchan);
+        }
 
 	spinlock_release(&sem->sem_lock);
 }
@@ -147,43 +244,173 @@ V(struct semaphore *sem)
 //
 // Lock.
 
-struct lock *
-lock_create(const char *name)
-{
-        struct lock *lock;
+/*
+ * Priority inheritance.
+ *
+ * pi_lock protects t_priority and t_blockedon of every thread, and
+ * the clearing of lk_holder on any lock somebody is waiting for (that
+ * is, with lk_nwaiters > 0). Holding it lets us follow the chain
+ * waiter -> lock -> holder -> lock -> holder ... without the threads
+ * on it going away underneath us. The uncontended paths of
+ * lock_acquire and lock_release never touch it.
+ *
+ * Lock ordering is: a lock's spin, then pi_lock, then wait channels,
+ * then run queues (which thread_raisepriority takes when it moves a
+ * holder up).
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
 
-        lock = kmalloc(sizeof(struct lock));
-        if (lock == NULL) {
-                return NULL;
+/*
+ * Bound on how far we follow a chain of lock holders. A longer chain
+ * is almost certainly a deadlock cycle, which we'd otherwise walk
+ * forever.
+ */
+#define PI_MAXDEPTH 16
+
+/*
+ * Compute the effective priority of the current thread: its base
+ * priority, raised to that of the most important thread waiting for
+ * any lock it still holds. Call with pi_lock held.
+ */
+static
+int
+lock_inherited_priority(void)
+{
+        struct lock *lk;
+        int pri, waitpri;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        pri = curthread->t_basepri;
+        for (lk = curthread->t_heldlocks; lk != NULL; lk = lk->lk_nextheld) {
+                if (lk->lk_nwaiters == 0) {
+                        continue;
+                }
+                waitpri = wchan_maxpriority(&lk->lk_wchan);
+                if (waitpri > pri) {
+                        pri = waitpri;
+                }
         }
+        return pri;
+}
 
-        lock->lk_name = kstrdup(name);
-        if (lock->lk_name == NULL) {
-                kfree(lock);
-                return NULL;
+/*
+ * We're about to wait for LOCK: lend our priority to its holder, and
+ * on down the chain if that thread is itself waiting for a lock. Call
+ * with lock->lk_spin and pi_lock held.
+ */
+static
+void
+lock_donate_priority(struct lock *lock)
+{
+        struct thread *holder;
+        struct lock *next;
+        int pri;
+        unsigned depth;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        pri = curthread->t_priority;
+        curthread->t_blockedon = lock;
+
+        for (depth = 0; lock != NULL && depth < PI_MAXDEPTH; depth++) {
+                holder = lock->lk_holder;
+                if (holder == NULL || holder->t_priority >= pri) {
+                        break;
+                }
+                /* Move it up in its run queue or next's channel too. */
+                next = holder->t_blockedon;
+                thread_raisepriority(holder, pri,
+                                     next != NULL ? &next->lk_wchan : NULL);
+                lock = next;
         }
-        
-        // add stuff here as needed
-        struct spinlock *spin;
-        spin = kmalloc(sizeof(struct spinlock));
-        if (spin == NULL) {
-                kfree(lock->lk_name);
-                kfree(lock);
-                return NULL;
+}
+
+void
+lock_update_priority(void)
+{
+        spinlock_acquire(&pi_lock);
+        curthread->t_priority = lock_inherited_priority();
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * Adaptive spinning.
+ *
+ * If the holder of a lock is running on another CPU it is likely to
+ * let go of it soon, in less time than it takes us to go to sleep and
+ * be woken up again. So rather than sleeping straight away we first
+ * busy-wait, for as long as the holder stays on its CPU or until
+ * LOCK_SPINMAX polls have gone by, and only sleep if that fails.
+ *
+ * We look at the holder's thread structure without any lock held. It
+ * can't be freed while the thread still holds the lock, and once it
+ * lets go we notice lk_holder change and stop; at worst a stale read
+ * makes us spin a little longer or sleep a little sooner.
+ */
+#define LOCK_SPINMAX 2000
+
+/*
+ * Return true if it's worth spinning on LOCK: its holder is running
+ * on some other CPU. Call with lock->lk_spin held.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+        struct thread *holder;
+
+        KASSERT(spinlock_do_i_hold(&lock->lk_spin));
+
+        holder = lock->lk_holder;
+        return holder != NULL && holder->t_state == S_RUN &&
+                holder->t_cpu != curcpu;
+}
+
+/*
+ * Busy-wait while HOLDER keeps holding LOCK and stays on its CPU.
+ * Call without lock->lk_spin held.
+ */
+static
+void
+lock_spin(struct lock *lock, struct thread *holder)
+{
+        volatile struct lock *vlock = lock;
+        volatile struct thread *vholder = holder;
+        unsigned i;
+
+        for (i = 0; i < LOCK_SPINMAX; i++) {
+                if (!vlock->held || vlock->lk_holder != holder ||
+                    vholder->t_state != S_RUN) {
+                        break;
+                }
         }
-        spinlock_init(spin);
-        lock->spin = spin;
+}
+
+struct lock *
+lock_create(const char *name)
+{
+        struct lock *lock;
+        const char *copy;
 
-        lock->lk_wchan = wchan_create(lock->lk_name);
-        if (lock->lk_wchan == NULL) {
-                kfree(lock->lk_name);
-                kfree(lock->spin);
-                kfree(lock);
+        lock = synch_alloc(sizeof(struct lock), name, &copy);
+        if (lock == NULL) {
                 return NULL;
         }
 
+        lock->lk_name = copy;
+        spinlock_init(&lock->lk_spin);
+        wchan_init(&lock->lk_wchan, lock->lk_name);
         lock->held = false;
         lock->lk_holder = NULL;
+        lock->lk_nwaiters = 0;
+        lock->lk_nextheld = NULL;
+        lock->lk_handoff = false;
+#if OPT_LOCKSTAT
+        lock->lk_stat = NULL;
+        lock->lk_acqtime = 0;
+        lock->lk_acqcpu = NULL;
+#endif
         
         return lock;
 }
@@ -192,49 +419,210 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+        KASSERT(lock->lk_holder == NULL);
+        KASSERT(lock->lk_nwaiters == 0);
 
-        // add stuff here as needed
-        
-        kfree(lock->lk_name);
-        kfree(lock->spin);
-        kfree(lock->lk_wchan);
+        spinlock_cleanup(&lock->lk_spin);
+        wchan_cleanup(&lock->lk_wchan);
         kfree(lock);
 }
 
+void
+lock_sethandoff(struct lock *lock, bool handoff)
+{
+        spinlock_acquire(&lock->lk_spin);
+        lock->lk_handoff = handoff;
+        spinlock_release(&lock->lk_spin);
+}
+
+/*
+ * Make the current thread the holder of LOCK, which is free or has
+ * just been handed to us by lock_release. Call with lock->lk_spin
+ * held.
+ */
+static
+void
+lock_take(struct lock *lock)
+{
+        KASSERT(spinlock_do_i_hold(&lock->lk_spin));
+        KASSERT(!lock->held || lock->lk_holder == curthread);
+
+        lock->held = true;
+        lock->lk_holder = curthread;
+        lock->lk_nextheld = curthread->t_heldlocks;
+        curthread->t_heldlocks = lock;
+
+        if (curthread->t_blockedon != NULL || lock->lk_nwaiters > 0) {
+                /*
+                 * We waited, or others are still waiting. In the
+                 * latter case we take over, from the previous
+                 * holder, the job of running on their behalf.
+                 */
+                spinlock_acquire(&pi_lock);
+                curthread->t_blockedon = NULL;
+                curthread->t_priority = lock_inherited_priority();
+                spinlock_release(&pi_lock);
+        }
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+        struct thread *holder;
+        bool spun, contended;
+        unsigned spins, hits, sleeps;
+
+        KASSERT(lock != NULL);
+
+        /* May not block in an interrupt handler. */
+        KASSERT(curthread->t_in_interrupt == false);
 
         if (lock_do_i_hold(lock)) {
                 panic("Tryin to acquire lock but already own it: %p\n", lock);
         }
 
         // Write this
-        spinlock_acquire(lock->spin);
-        while(lock->held) {
-                wchan_lock(lock->lk_wchan);
-                spinlock_release(lock->spin);
-                wchan_sleep(lock->lk_wchan);
-                spinlock_acquire(lock->spin);
+        spinlock_acquire(&lock->lk_spin);
+        contended = lock->held;
+        spun = false;
+        spins = hits = sleeps = 0;
+        /* In handoff mode, lock_release may make us the holder. */
+        while(lock->held && lock->lk_holder != curthread) {
+                if (!spun && lock_holder_running(lock)) {
+                        /* Spin at most once per trip to sleep. */
+                        spun = true;
+                        holder = lock->lk_holder;
+                        spinlock_release(&lock->lk_spin);
+                        spins++;
+                        lock_spin(lock, holder);
+                        spinlock_acquire(&lock->lk_spin);
+                        if (!lock->held) {
+                                hits++;
+                        }
+                        continue;
+                }
+
+                /*
+                 * Lend our priority to the holder before going to
+                 * sleep. Lock the wchan before dropping pi_lock so
+                 * that a holder recomputing its priority in
+                 * lock_release can't miss us in the window between
+                 * the two.
+                 */
+                lock->lk_nwaiters++;
+                spinlock_acquire(&pi_lock);
+                lock_donate_priority(lock);
+                wchan_lock(&lock->lk_wchan);
+                spinlock_release(&pi_lock);
+                spinlock_release(&lock->lk_spin);
+                trace(TRACE_LOCKWAIT, (uintptr_t)lock,
+                      (uintptr_t)lock->lk_holder, 0, 0);
+                sleeps++;
+                wchan_sleep(&lock->lk_wchan);
+                spinlock_acquire(&lock->lk_spin);
+                lock->lk_nwaiters--;
+                spun = false;
         }
 
-        lock->held = true;
-        lock->lk_holder = curthread;
-        spinlock_release(lock->spin);
+        lock_take(lock);
+        lockstat_lock_acquired(lock, contended, spins, hits, sleeps);
+        spinlock_release(&lock->lk_spin);
+}
+
+bool
+lock_tryacquire(struct lock *lock)
+{
+        KASSERT(lock != NULL);
+
+        if (lock_do_i_hold(lock)) {
+                panic("Tryin to acquire lock but already own it: %p\n", lock);
+        }
+
+        spinlock_acquire(&lock->lk_spin);
+        if (lock->held) {
+                spinlock_release(&lock->lk_spin);
+                return false;
+        }
+        lock_take(lock);
+        lockstat_lock_acquired(lock, false, 0, 0, 0);
+        spinlock_release(&lock->lk_spin);
+        return true;
 }
 
 void
 lock_release(struct lock *lock)
 {
+        struct lock **lkp;
+        struct thread *next;
+        int oldpri;
+        bool lowered;
+
+        KASSERT(lock != NULL);
+
         if (!lock_do_i_hold(lock)) {
                 panic("Tryin to release lock but don't own it: %p\n", lock);
         }
         // Write this
-        spinlock_acquire(lock->spin);
-        lock->held = false;
-        lock->lk_holder = NULL;
-        wchan_wakeone(lock->lk_wchan);
-        spinlock_release(lock->spin);
+        spinlock_acquire(&lock->lk_spin);
+
+        /* Take it off our list of held locks; usually it's first. */
+        for (lkp = &curthread->t_heldlocks; *lkp != lock;
+             lkp = &(*lkp)->lk_nextheld) {
+                KASSERT(*lkp != NULL);
+        }
+        *lkp = lock->lk_nextheld;
+        lock->lk_nextheld = NULL;
+        lockstat_lock_release(lock);
+
+        /*
+         * In handoff mode the first waiter becomes the holder. It
+         * can't get anywhere until we drop lk_spin, so there's no
+         * hurry to fill in lk_holder after waking it; and since a
+         * waiter counts in lk_nwaiters, we do that below with
+         * pi_lock held, as lk_holder changes on contended locks must
+         * be. The waiter clears its own t_blockedon in lock_take.
+         */
+        next = NULL;
+        if (lock->lk_handoff) {
+                next = wchan_wakeone(&lock->lk_wchan);
+        }
+
+        lowered = false;
+        if (lock->lk_nwaiters > 0 ||
+            curthread->t_priority != curthread->t_basepri) {
+                /*
+                 * Someone may be following the chain through this
+                 * lock, or we may have been running on a waiter's
+                 * behalf; give back whatever we inherited through
+                 * this lock.
+                 */
+                spinlock_acquire(&pi_lock);
+                lock->held = next != NULL;
+                lock->lk_holder = next;
+                oldpri = curthread->t_priority;
+                curthread->t_priority = lock_inherited_priority();
+                lowered = curthread->t_priority < oldpri;
+                spinlock_release(&pi_lock);
+        }
+        else {
+                KASSERT(next == NULL);
+                lock->held = false;
+                lock->lk_holder = NULL;
+        }
+        if (!lock->lk_handoff) {
+                wchan_wakeone(&lock->lk_wchan);
+        }
+        spinlock_release(&lock->lk_spin);
+
+        if (lowered && curthread->t_iplhigh_count == 0) {
+                /*
+                 * We were only running because of the waiter we
+                 * just woke; let it have the processor now rather
+                 * than at the next timer tick. (Not if we hold a
+                 * spinlock, as cv_wait does when it gets here.)
+                 */
+                thread_yield();
+        }
 }
 
 bool
@@ -253,25 +641,16 @@ struct cv *
 cv_create(const char *name)
 {
         struct cv *cv;
+        const char *copy;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = synch_alloc(sizeof(struct cv), name, &copy);
         if (cv == NULL) {
                 return NULL;
         }
 
-        cv->cv_name = kstrdup(name);
-        if (cv->cv_name==NULL) {
-                kfree(cv);
-                return NULL;
-        }
-        
-        cv->cv_wchan = wchan_create(cv->cv_name);
-        if (cv->cv_wchan == NULL) {
-                kfree(cv->cv_name);
-                kfree(cv);
-                return NULL;
-        }
-        
+        cv->cv_name = copy;
+        wchan_init(&cv->cv_wchan, cv->cv_name);
+
         return cv;
 }
 
@@ -280,32 +659,225 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        // add stuff here as needed
-        
-        kfree(cv->cv_name);
-        kfree(cv->cv_wchan);
+        wchan_cleanup(&cv->cv_wchan);
         kfree(cv);
 }
 
+/*
+ * Wait morphing.
+ *
+ * Waking a thread from a CV is pointless while the signaller still
+ * holds the lock: the thread would only run to find the lock held and
+ * go back to sleep on it. So cv_signal and cv_broadcast don't wake
+ * anybody; they move the waiters straight onto the lock's wait
+ * channel, where lock_release wakes them one at a time as the lock
+ * is handed on. A broadcast thus costs one wakeup per handoff rather
+ * than a stampede.
+ *
+ * Moved threads are counted in lk_nwaiters, so lock_release takes
+ * them into account for priority inheritance and lock_destroy sees
+ * them. Each takes itself back out when it wakes, before going
+ * through lock_acquire like anyone else (or, for a lock in handoff
+ * mode, finding it already owns the lock).
+ *
+ * Lock order here is the CV's channel, then the lock's spinlock, then
+ * the lock's channel; cv_wait takes them in the same order when it
+ * calls lock_release.
+ */
+static
+void
+cv_morph(struct cv *cv, struct lock *lock, bool all)
+{
+        unsigned moved;
+
+        wchan_lock(&cv->cv_wchan);
+        spinlock_acquire(&lock->lk_spin);
+        wchan_lock(&lock->lk_wchan);
+        moved = wchan_transfer(&cv->cv_wchan, &lock->lk_wchan, all);
+        lock->lk_nwaiters += moved;
+        wchan_unlock(&lock->lk_wchan);
+        spinlock_release(&lock->lk_spin);
+        wchan_unlock(&cv->cv_wchan);
+}
+
+/*
+ * Called by a thread that was moved by cv_morph once it has been
+ * woken from the lock's channel. Reacquire the lock, unless
+ * lock_release already handed it to us.
+ */
+static
+void
+cv_unmorph(struct lock *lock)
+{
+        spinlock_acquire(&lock->lk_spin);
+        KASSERT(lock->lk_nwaiters > 0);
+        lock->lk_nwaiters--;
+        if (lock->held && lock->lk_holder == curthread) {
+                lock_take(lock);
+                lockstat_lock_acquired(lock, true, 0, 0, 1);
+                spinlock_release(&lock->lk_spin);
+                return;
+        }
+        spinlock_release(&lock->lk_spin);
+        lock_acquire(lock);
+}
+
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {       
-        wchan_lock(cv->cv_wchan);
+        KASSERT(lock_do_i_hold(lock));
+        wchan_lock(&cv->cv_wchan);
         lock_release(lock);
-        wchan_sleep(cv->cv_wchan);
-        lock_acquire(lock);
+        wchan_sleep(&cv->cv_wchan);
+        cv_unmorph(lock);
+}
+
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned timeout_ms)
+{
+        uint32_t deadline;
+        int result;
+
+        KASSERT(lock_do_i_hold(lock));
+        deadline = clock_ticks() + clock_mstoticks(timeout_ms);
+        wchan_lock(&cv->cv_wchan);
+        lock_release(lock);
+        result = wchan_timedsleep(&cv->cv_wchan, deadline);
+        if (result == 0) {
+                cv_unmorph(lock);
+        }
+        else {
+                lock_acquire(lock);
+        }
+        return result;
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {       
         KASSERT(lock_do_i_hold(lock));
-        wchan_wakeone(cv->cv_wchan);
+        cv_morph(cv, lock, false);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {       
         KASSERT(lock_do_i_hold(lock));
-		wchan_wakeall(cv->cv_wchan);
+        cv_morph(cv, lock, true);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+        const char *copy;
+
+        rw = synch_alloc(sizeof(struct rwlock), name, &copy);
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = copy;
+        spinlock_init(&rw->rw_spin);
+        wchan_init(&rw->rw_readwchan, rw->rw_name);
+        wchan_init(&rw->rw_writewchan, rw->rw_name);
+        rw->rw_readers = 0;
+        rw->rw_waitingwriters = 0;
+        rw->rw_writer = NULL;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+        KASSERT(rw->rw_waitingwriters == 0);
+
+        spinlock_cleanup(&rw->rw_spin);
+        wchan_cleanup(&rw->rw_readwchan);
+        wchan_cleanup(&rw->rw_writewchan);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_spin);
+        while (rw->rw_writer != NULL || rw->rw_waitingwriters > 0) {
+                wchan_lock(&rw->rw_readwchan);
+                spinlock_release(&rw->rw_spin);
+                wchan_sleep(&rw->rw_readwchan);
+                spinlock_acquire(&rw->rw_spin);
+        }
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_spin);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_spin);
+        KASSERT(rw->rw_readers > 0);
+        rw->rw_readers--;
+        if (rw->rw_readers == 0 && rw->rw_waitingwriters > 0) {
+                wchan_wakeone(&rw->rw_writewchan);
+        }
+        spinlock_release(&rw->rw_spin);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_spin);
+        rw->rw_waitingwriters++;
+        while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+                wchan_lock(&rw->rw_writewchan);
+                spinlock_release(&rw->rw_spin);
+                wchan_sleep(&rw->rw_writewchan);
+                spinlock_acquire(&rw->rw_spin);
+        }
+        rw->rw_waitingwriters--;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_spin);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_spin);
+        KASSERT(rw->rw_writer == curthread);
+        rw->rw_writer = NULL;
+        /* Hand off to the next writer if there is one; else to readers. */
+        if (rw->rw_waitingwriters > 0) {
+                wchan_wakeone(&rw->rw_writewchan);
+        }
+        else {
+                wchan_wakeall(&rw->rw_readwchan);
+        }
+        spinlock_release(&rw->rw_spin);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        return rw->rw_writer == curthread;
 }
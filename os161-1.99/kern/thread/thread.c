@@ -40,6 +40,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <atomic.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -47,6 +48,9 @@
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
+#include <trace.h>
+#include <workq.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
@@ -57,13 +61,6 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
-/* Wait channel. */
-struct wchan {
-	const char *wc_name;		/* name for this channel */
-	struct threadlist wc_threads;	/* list of waiting threads */
-	struct spinlock wc_lock;	/* lock for mutual exclusion */
-};
-
 /* Master array of CPUs. */
 DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
@@ -72,6 +69,12 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Ends timed sleeps; see wchan_timedsleep. */
+static void wchan_timeout(void *data);
+
+/* Body of each cpu's idle thread; see thread_switch. */
+static void thread_idle(void *junk, unsigned long junk2);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -149,6 +152,27 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Scheduling fields */
+	thread->t_basepri = PRI_DEFAULT;
+	thread->t_priority = PRI_DEFAULT;
+	thread->t_blockedon = NULL;
+	thread->t_heldlocks = NULL;
+	thread->t_affinity = CPUMASK_ALL;
+	thread->t_handoff = NULL;
+
+	callout_init(&thread->t_timeout, wchan_timeout, thread);
+	thread->t_timedwchan = NULL;
+	thread->t_timedout = false;
+	thread->t_inboxnext = NULL;
+
+	thread->t_ticks = 0;
+	thread->t_recent = 0;
+	thread->t_recentstamp = 0;
+	thread->t_volswitches = 0;
+	thread->t_involswitches = 0;
+	thread->t_sleepticks = 0;
+	thread->t_sleepstart = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -180,10 +204,20 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_migrating = NULL;
+	c->c_idlethread = NULL;
+	c->c_softwork = NULL;
+	c->c_softtail = &c->c_softwork;
+	c->c_softrunning = false;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	spinlock_setname(&c->c_runqueue_lock, "c_runqueue_lock");
+	spinlock_setticket(&c->c_runqueue_lock);
+
+	c->c_inbox = NULL;
+	spinlock_data_set(&c->c_unidling, 0);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -193,6 +227,8 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	/* Affinity masks have one bit per cpu. */
+	KASSERT(c->c_number < 32);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -222,6 +258,30 @@ cpu_create(unsigned hardware_number)
 	}
 	c->c_curthread->t_cpu = c;
 
+	/*
+	 * The idle thread never goes on a run queue; thread_switch
+	 * switches to it directly. Like a new thread from
+	 * thread_fork, it starts out holding the run queue lock.
+	 */
+	snprintf(namebuf, sizeof(namebuf), "<idle #%d>", c->c_number);
+	c->c_idlethread = thread_create(namebuf);
+	if (c->c_idlethread == NULL) {
+		panic("cpu_create: thread_create failed\n");
+	}
+	c->c_idlethread->t_stack = kmalloc(STACK_SIZE);
+	if (c->c_idlethread->t_stack == NULL) {
+		panic("cpu_create: couldn't allocate stack");
+	}
+	thread_checkstack_init(c->c_idlethread);
+	c->c_idlethread->t_cpu = c;
+	c->c_idlethread->t_affinity = CPUMASK(c->c_number);
+	result = proc_addthread(kproc, c->c_idlethread);
+	if (result) {
+		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
+	}
+	c->c_idlethread->t_iplhigh_count++;
+	switchframe_init(c->c_idlethread, thread_idle, NULL, 0);
+
 	cpu_machdep_init(c);
 
 	return c;
@@ -426,10 +486,126 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put a thread on a run queue or wait channel list in priority order.
+ * It goes after every thread of the same or higher priority, so that
+ * threads of equal priority stay in FIFO order. Scan from the tail,
+ * since in the common case everything has the same priority and we
+ * stop at the first step.
+ */
+static
+void
+thread_enqueue(struct threadlist *tl, struct thread *t)
+{
+	struct thread *itr;
+
+	THREADLIST_FORALL_REV(itr, *tl) {
+		if (itr->t_priority >= t->t_priority) {
+			threadlist_insertafter(tl, itr, t);
+			return;
+		}
+	}
+	threadlist_addhead(tl, t);
+}
+
+/*
+ * If T is on TL, move it to where its (raised) priority puts it.
+ * Returns true if it was there. Call with TL's lock held.
+ */
+static
+bool
+thread_requeue(struct threadlist *tl, struct thread *t)
+{
+	struct thread *itr;
+
+	THREADLIST_FORALL(itr, *tl) {
+		if (itr == t) {
+			threadlist_remove(tl, t);
+			thread_enqueue(tl, t);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Wakeup inbox.
+ *
+ * Waking up a thread that belongs to another cpu would mean taking
+ * that cpu's run queue lock, usually while already holding a wait
+ * channel lock, so remote wakeups would be serialized with the other
+ * cpu's own scheduling. Instead the waker pushes the thread onto the
+ * other cpu's c_inbox without locking anything, and that cpu moves
+ * it to its run queue next time it goes through thread_switch.
+ *
+ * An idle cpu has to be poked with IPI_UNIDLE. The first waker to
+ * set c_unidling sends it; the rest don't, until the cpu clears the
+ * flag again on its way back round the idle loop.
+ *
+ * The idle cpu sets c_isidle before its last look in the inbox, and
+ * the waker pushes before it looks at c_isidle, so either the cpu
+ * finds the thread or the waker finds the cpu idle.
+ */
+static
+void
+thread_inbox_push(struct cpu *targetcpu, struct thread *target)
+{
+	struct thread *head;
+
+	do {
+		head = targetcpu->c_inbox;
+		target->t_inboxnext = head;
+	} while (!atomic_casptr((void *volatile *)&targetcpu->c_inbox,
+				head, target));
+
+	if (targetcpu->c_isidle) {
+		/* testandset can fail spuriously; only trust a 0. */
+		while (spinlock_data_get(&targetcpu->c_unidling) == 0) {
+			if (spinlock_data_testandset(&targetcpu->c_unidling)
+			    == 0) {
+				ipi_send(targetcpu, IPI_UNIDLE);
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Move everything in our inbox onto the run queue. The inbox is a
+ * stack, so turn it round first to keep the wakeups in order. Call
+ * with our run queue locked.
+ */
+static
+void
+thread_inbox_drain(void)
+{
+	struct thread *list, *t, *next;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	list = atomic_swapptr((void *volatile *)&curcpu->c_inbox, NULL);
+
+	t = NULL;
+	while (list != NULL) {
+		next = list->t_inboxnext;
+		list->t_inboxnext = t;
+		t = list;
+		list = next;
+	}
+	while (t != NULL) {
+		next = t->t_inboxnext;
+		t->t_inboxnext = NULL;
+		thread_enqueue(&curcpu->c_runqueue, t);
+		t = next;
+	}
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too. 
+ * targetcpu might be curcpu; it might not be, too. If it isn't, the
+ * thread goes in targetcpu's inbox instead of straight on its run
+ * queue.
  */
 static
 void
@@ -438,9 +614,15 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	struct cpu *targetcpu;
 	bool isidle;
 
-	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
+	if (!already_have_lock && targetcpu != curcpu->c_self) {
+		thread_inbox_push(targetcpu, target);
+		return;
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
+
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
@@ -450,7 +632,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_enqueue(&targetcpu->c_runqueue, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -464,6 +646,91 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Return the mask of all cpus.
+ */
+uint32_t
+thread_cpumask(void)
+{
+	unsigned numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	return numcpus >= 32 ? CPUMASK_ALL : CPUMASK(numcpus) - 1;
+}
+
+/*
+ * Choose a cpu in MASK for a thread to run on: the current one if
+ * allowed, otherwise the one with the shortest run queue. (We peek at
+ * the run queues without locking; it's only a hint.)
+ */
+static
+struct cpu *
+thread_pickcpu(uint32_t mask)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+
+	KASSERT((mask & thread_cpumask()) != 0);
+
+	if (mask & CPUMASK(curcpu->c_number)) {
+		return curcpu->c_self;
+	}
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((mask & CPUMASK(c->c_number)) == 0) {
+			continue;
+		}
+		if (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count) {
+			best = c;
+		}
+	}
+	return best;
+}
+
+/*
+ * If the thread we switched away from isn't allowed on this cpu any
+ * more (see thread_switch), put it on the run queue of one where it
+ * is. Its context is saved now, so it's safe for another cpu to pick
+ * it up.
+ */
+static
+void
+thread_sendmigrating(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_migrating;
+	if (t == NULL) {
+		return;
+	}
+	curcpu->c_migrating = NULL;
+	t->t_cpu = thread_pickcpu(t->t_affinity);
+	DEBUG(DB_THREADS, "Moved thread %s: cpu %u -> %u",
+	      t->t_name, curcpu->c_number, t->t_cpu->c_number);
+	thread_make_runnable(t, false);
+}
+
+/*
+ * Set the current thread's affinity mask. If we're on a cpu that's no
+ * longer allowed, yield; thread_switch moves us.
+ */
+int
+thread_setaffinity(uint32_t mask)
+{
+	mask &= thread_cpumask();
+	if (mask == 0) {
+		return EINVAL;
+	}
+	curthread->t_affinity = mask;
+	if ((mask & CPUMASK(curcpu->c_number)) == 0) {
+		thread_yield();
+	}
+	return 0;
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -479,10 +746,29 @@ thread_fork(const char *name,
 	    struct proc *proc,
 	    void (*entrypoint)(void *data1, unsigned long data2),
 	    void *data1, unsigned long data2)
+{
+	return thread_fork_affinity(name, proc, entrypoint, data1, data2,
+				    curthread->t_affinity);
+}
+
+/*
+ * As thread_fork, but the new thread may only run on the cpus in
+ * MASK. It starts on the caller's cpu if that's one of them.
+ */
+int
+thread_fork_affinity(const char *name,
+		     struct proc *proc,
+		     void (*entrypoint)(void *data1, unsigned long data2),
+		     void *data1, unsigned long data2, uint32_t mask)
 {
 	struct thread *newthread;
 	int result;
 
+	mask &= thread_cpumask();
+	if (mask == 0) {
+		return EINVAL;
+	}
+
 #ifdef UW
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
@@ -505,7 +791,12 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = mask;
+	newthread->t_cpu = thread_pickcpu(mask);
+
+	/* Scheduling fields; inherit only the base priority */
+	newthread->t_basepri = curthread->t_basepri;
+	newthread->t_priority = curthread->t_basepri;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -528,7 +819,7 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Make the new thread runnable on its cpu */
 	thread_make_runnable(newthread, false);
 
 	return 0;
@@ -570,21 +861,55 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
-	/* Lock the run queue. */
+	/* Lock the run queue, and pick up any remote wakeups. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_inbox_drain();
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. (Unless
+	 * we're no longer allowed on this cpu.)
+	 */
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    (cur->t_affinity & CPUMASK(curcpu->c_number)) &&
+	    cur != curcpu->c_idlethread) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/*
+	 * Count the switch. Being told to yield from inside an
+	 * interrupt means hardclock is preempting us.
+	 */
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		cur->t_involswitches++;
+	}
+	else {
+		cur->t_volswitches++;
+	}
+	if (newstate == S_SLEEP) {
+		cur->t_sleepstart = clock_ticks();
+	}
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		if (cur == curcpu->c_idlethread) {
+			/* Parked until thread_switch wants it again. */
+			break;
+		}
+		if ((cur->t_affinity & CPUMASK(curcpu->c_number)) == 0) {
+			/*
+			 * We can't go on another cpu's run queue while
+			 * we're still running here; leave it to
+			 * whoever runs next to send us on.
+			 */
+			KASSERT(curcpu->c_migrating == NULL);
+			curcpu->c_migrating = cur;
+			break;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
@@ -602,7 +927,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		 * or want it locked and if it does can lock it itself
 		 * without racing. Exercise: what's the other?)
 		 */
-		threadlist_addtail(&wc->wc_threads, cur);
+		thread_enqueue(&wc->wc_threads, cur);
 		wchan_unlock(wc);
 		break;
 	    case S_ZOMBIE:
@@ -632,15 +957,29 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
+		spinlock_data_set(&curcpu->c_unidling, 0);
+		thread_inbox_drain();
 		next = threadlist_remhead(&curcpu->c_runqueue);
+		if (next == NULL && curcpu->c_migrating == cur) {
+			/*
+			 * We can't idle on the stack of a thread that
+			 * has to be sent on: it isn't saved until we
+			 * switch away from it. Idle on the idle thread
+			 * instead; it sends this one on as it starts.
+			 */
+			next = curcpu->c_idlethread;
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
+			softwork_run(false);
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	trace(TRACE_SWITCH, (uintptr_t)next, newstate, 0, 0);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -705,6 +1044,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Charge the time we spent asleep. */
+	if (newstate == S_SLEEP) {
+		cur->t_sleepticks += clock_ticks() - cur->t_sleepstart;
+	}
+
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -714,6 +1058,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on a thread that had to leave this cpu. */
+	thread_sendmigrating();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -747,6 +1094,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on a thread that had to leave this cpu. */
+	thread_sendmigrating();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -808,6 +1158,41 @@ thread_exit(void)
 	panic("The zombie walks!\n");
 }
 
+/*
+ * Decay T's recent tick count to the present: halve it for each
+ * half-life gone by since it was last brought up to date.
+ */
+static
+unsigned
+thread_decayrecent(struct thread *t, uint32_t now, uint32_t *stamp)
+{
+	uint32_t halflife, periods;
+
+	halflife = clock_mstoticks(THREAD_RECENT_HALFLIFE);
+	periods = (now - t->t_recentstamp) / halflife;
+	*stamp = t->t_recentstamp + periods * halflife;
+	return periods >= 32 ? 0 : t->t_recent >> periods;
+}
+
+void
+thread_accounttick(void)
+{
+	struct thread *cur = curthread;
+	uint32_t stamp;
+
+	cur->t_ticks++;
+	cur->t_recent = thread_decayrecent(cur, clock_ticks(), &stamp) + 1;
+	cur->t_recentstamp = stamp;
+}
+
+unsigned
+thread_recentticks(struct thread *t)
+{
+	uint32_t stamp;
+
+	return thread_decayrecent(t, clock_ticks(), &stamp);
+}
+
 /*
  * Yield the cpu to another process, but stay runnable.
  */
@@ -817,6 +1202,24 @@ thread_yield(void)
 	thread_switch(S_READY, NULL);
 }
 
+/*
+ * Each cpu's idle thread. thread_switch only runs it when the thread
+ * it's switching away from needs sending to another cpu and there's
+ * nothing else to run. Yielding parks it again, and with an empty run
+ * queue the cpu idles here, on a stack nobody else needs.
+ */
+static
+void
+thread_idle(void *junk, unsigned long junk2)
+{
+	(void)junk;
+	(void)junk2;
+
+	while (1) {
+		thread_yield();
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -830,11 +1233,63 @@ void
 schedule(void)
 {
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Nothing to do: threads are queued in priority order, and
+	 * thread_raisepriority moves them up when they inherit.
 	 */
 }
 
+/*
+ * Set the current thread's base priority. The effective priority is
+ * recomputed by the lock code, because we might be holding a lock
+ * that someone more important is waiting for.
+ */
+void
+thread_setpriority(int pri)
+{
+	KASSERT(pri >= PRI_MIN && pri <= PRI_MAX);
+
+	curthread->t_basepri = pri;
+	lock_update_priority();
+}
+
+/*
+ * Raise T's effective priority to PRI, for priority inheritance (see
+ * synch.c), and move it up wherever it's waiting to match: on WC if
+ * it's asleep there, otherwise on its cpu's run queue. A thread asleep
+ * on some other channel stays put until it's next queued; we can't
+ * take that channel's lock here.
+ *
+ * The caller holds the lock code's inheritance spinlock, which comes
+ * before WC and the run queues in the lock order.
+ */
+void
+thread_raisepriority(struct thread *t, int pri, struct wchan *wc)
+{
+	struct cpu *c;
+	bool found;
+
+	KASSERT(pri > t->t_priority);
+	t->t_priority = pri;
+
+	if (wc != NULL) {
+		spinlock_acquire(&wc->wc_lock);
+		found = thread_requeue(&wc->wc_threads, t);
+		spinlock_release(&wc->wc_lock);
+		if (found) {
+			return;
+		}
+	}
+
+	/*
+	 * If it's migrating or in an inbox it isn't on any run queue
+	 * yet, and thread_enqueue will see the new priority when it is.
+	 */
+	c = t->t_cpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	thread_requeue(&c->c_runqueue, t);
+	spinlock_release(&c->c_runqueue_lock);
+}
+
 /*
  * Thread migration.
  *
@@ -923,8 +1378,18 @@ thread_consider_migration(void)
 				continue;
 			}
 
+			/*
+			 * Likewise keep threads that aren't allowed
+			 * on this cpu; they go back home below.
+			 */
+			if ((t->t_affinity & CPUMASK(c->c_number)) == 0) {
+				threadlist_addtail(&victims, t);
+				to_send--;
+				continue;
+			}
+
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			thread_enqueue(&c->c_runqueue, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1413,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			thread_enqueue(&curcpu->c_runqueue, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -980,10 +1445,16 @@ wchan_create(const char *name)
 	if (wc == NULL) {
 		return NULL;
 	}
+	wchan_init(wc, name);
+	return wc;
+}
+
+void
+wchan_init(struct wchan *wc, const char *name)
+{
 	spinlock_init(&wc->wc_lock);
 	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
-	return wc;
 }
 
 /*
@@ -992,10 +1463,16 @@ wchan_create(const char *name)
  */
 void
 wchan_destroy(struct wchan *wc)
+{
+	wchan_cleanup(wc);
+	kfree(wc);
+}
+
+void
+wchan_cleanup(struct wchan *wc)
 {
 	spinlock_cleanup(&wc->wc_lock);
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
 }
 
 /*
@@ -1025,13 +1502,70 @@ wchan_sleep(struct wchan *wc)
 	/* may not sleep in an interrupt handler */
 	KASSERT(!curthread->t_in_interrupt);
 
+	lockstat_wchan_sleep(wc);
 	thread_switch(S_SLEEP, wc);
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * Callout for the end of a timed sleep: if the thread is still on
+ * the wait channel, take it off and wake it.
  */
+static
 void
+wchan_timeout(void *data)
+{
+	struct thread *target = data;
+	struct wchan *wc = target->t_timedwchan;
+	struct thread *t;
+
+	spinlock_acquire(&wc->wc_lock);
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (t == target) {
+			threadlist_remove(&wc->wc_threads, target);
+			target->t_timedout = true;
+			thread_make_runnable(target, false);
+			break;
+		}
+	}
+	spinlock_release(&wc->wc_lock);
+}
+
+/*
+ * Like wchan_sleep, but give up at tick DEADLINE (see clock.h).
+ * Returns 0 if woken up, or ETIMEDOUT if the deadline came first.
+ *
+ * The callout is armed with the channel locked, before we go onto it,
+ * so wchan_timeout can't look for us too early.
+ */
+int
+wchan_timedsleep(struct wchan *wc, uint32_t deadline)
+{
+	struct thread *cur = curthread;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!cur->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	if (!clock_tick_before(clock_ticks(), deadline)) {
+		wchan_unlock(wc);
+		return ETIMEDOUT;
+	}
+
+	cur->t_timedwchan = wc;
+	cur->t_timedout = false;
+	callout_schedule(&cur->t_timeout, deadline);
+
+	wchan_sleep(wc);
+
+	callout_stop(&cur->t_timeout);
+	cur->t_timedwchan = NULL;
+	return cur->t_timedout ? ETIMEDOUT : 0;
+}
+
+/*
+ * Wake up one thread sleeping on a wait channel.
+ */
+struct thread *
 wchan_wakeone(struct wchan *wc)
 {
 	struct thread *target;
@@ -1047,10 +1581,11 @@ wchan_wakeone(struct wchan *wc)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
 	thread_make_runnable(target, false);
+	return target;
 }
 
 /*
@@ -1090,6 +1625,55 @@ wchan_wakeall(struct wchan *wc)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move one thread (or all of them, if ALL is true) from one wait
+ * channel to another without waking them, highest priority first.
+ * Both channels must be locked. Returns the number moved.
+ */
+unsigned
+wchan_transfer(struct wchan *from, struct wchan *to, bool all)
+{
+	struct thread *target;
+	unsigned moved;
+
+	KASSERT(spinlock_do_i_hold(&from->wc_lock));
+	KASSERT(spinlock_do_i_hold(&to->wc_lock));
+
+	moved = 0;
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		thread_enqueue(&to->wc_threads, target);
+		moved++;
+		if (!all) {
+			break;
+		}
+	}
+	return moved;
+}
+
+/*
+ * Return the highest effective priority of any thread sleeping on the
+ * channel, or -1 if there are none. This is used by the lock code for
+ * priority inheritance.
+ */
+int
+wchan_maxpriority(struct wchan *wc)
+{
+	struct thread *t;
+	int ret;
+
+	ret = -1;
+	spinlock_acquire(&wc->wc_lock);
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (t->t_priority > ret) {
+			ret = t->t_priority;
+		}
+	}
+	spinlock_release(&wc->wc_lock);
+
+	return ret;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1189,7 +1773,9 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_UNIDLE)) {
 		/*
 		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
+		 * interrupt; don't need to do anything else. (The
+		 * idle loop in thread_switch clears c_unidling and
+		 * collects the wakeups.)
 		 */
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
@@ -0,0 +1,251 @@
+/*
+ * Kernel event tracing. See <trace.h>.
+ *
+ * Each CPU records only into its own ring, with interrupts off, so
+ * recording needs no lock. A ring's tb_next counts every record ever
+ * made into it, and the record goes in slot tb_next % TRACE_NRECORDS.
+ *
+ * To stop, we clear trace_enabled and then wait for any CPU still in
+ * the middle of a record (tb_busy) to finish. A CPU sets tb_busy
+ * before looking at trace_enabled again, so once we've seen tb_busy
+ * clear, that CPU won't touch its ring until tracing is restarted.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spl.h>
+#include <atomic.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <clock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <trace.h>
+
+struct tracebuf {
+	struct trace_record *tb_recs;	/* TRACE_NRECORDS of them */
+	volatile unsigned tb_next;	/* records made, ever */
+	volatile bool tb_busy;		/* in the middle of one */
+};
+
+volatile bool trace_enabled;
+
+static struct tracebuf *tracebufs;
+static unsigned ntracebufs;
+
+/* For trace_start, trace_stop, and trace_dump. */
+static struct lock trace_lock = LOCK_INITIALIZER(trace_lock, "trace_lock");
+
+void
+trace_event(unsigned event, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+	struct tracebuf *tb;
+	struct trace_record *rec;
+	time_t secs;
+	uint32_t nsecs;
+	int spl;
+
+	spl = splhigh();
+	tb = &tracebufs[curcpu->c_number];
+	tb->tb_busy = true;
+	atomic_membar();
+	if (!trace_enabled) {
+		/* Being stopped; the rings may be being read. */
+		tb->tb_busy = false;
+		splx(spl);
+		return;
+	}
+
+	gettime(&secs, &nsecs);
+	rec = &tb->tb_recs[tb->tb_next % TRACE_NRECORDS];
+	rec->tr_sec = secs;
+	rec->tr_nsec = nsecs;
+	rec->tr_event = event;
+	rec->tr_cpu = curcpu->c_number;
+	rec->tr_thread = (uintptr_t)curthread;
+	rec->tr_args[0] = a0;
+	rec->tr_args[1] = a1;
+	rec->tr_args[2] = a2;
+	rec->tr_args[3] = a3;
+	tb->tb_next++;
+
+	atomic_membar();
+	tb->tb_busy = false;
+	splx(spl);
+}
+
+/*
+ * Stop recording and wait for any record in progress to finish.
+ * Call with trace_lock held.
+ */
+static
+void
+trace_quiesce(void)
+{
+	unsigned i;
+
+	trace_enabled = false;
+	atomic_membar();
+	for (i=0; i<ntracebufs; i++) {
+		while (tracebufs[i].tb_busy) {
+			/* spin; the recorder has interrupts off */
+		}
+	}
+}
+
+int
+trace_start(void)
+{
+	uint32_t mask;
+	unsigned i;
+
+	lock_acquire(&trace_lock);
+	if (tracebufs == NULL) {
+		/* The CPUs are numbered from 0, one bit each in the mask. */
+		mask = thread_cpumask();
+		ntracebufs = 0;
+		while (ntracebufs < 32 && (mask & CPUMASK(ntracebufs)) != 0) {
+			ntracebufs++;
+		}
+
+		tracebufs = kmalloc(ntracebufs * sizeof(*tracebufs));
+		if (tracebufs == NULL) {
+			lock_release(&trace_lock);
+			return ENOMEM;
+		}
+		for (i=0; i<ntracebufs; i++) {
+			tracebufs[i].tb_recs =
+				kmalloc(TRACE_NRECORDS *
+					sizeof(struct trace_record));
+			if (tracebufs[i].tb_recs == NULL) {
+				while (i > 0) {
+					kfree(tracebufs[--i].tb_recs);
+				}
+				kfree(tracebufs);
+				tracebufs = NULL;
+				lock_release(&trace_lock);
+				return ENOMEM;
+			}
+			tracebufs[i].tb_busy = false;
+		}
+	}
+
+	trace_quiesce();
+	for (i=0; i<ntracebufs; i++) {
+		tracebufs[i].tb_next = 0;
+	}
+	atomic_membar();
+	trace_enabled = true;
+	lock_release(&trace_lock);
+	return 0;
+}
+
+void
+trace_stop(void)
+{
+	lock_acquire(&trace_lock);
+	trace_quiesce();
+	lock_release(&trace_lock);
+}
+
+/*
+ * Write LEN bytes from BUF at *POS in VN, advancing *POS.
+ */
+static
+int
+trace_write(struct vnode *vn, off_t *pos, const void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, (void *)buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	*pos = ku.uio_offset;
+	return 0;
+}
+
+/* How many records CPU ring TB holds; the oldest is first. */
+static
+unsigned
+trace_count(struct tracebuf *tb, unsigned *first)
+{
+	unsigned n;
+
+	n = tb->tb_next < TRACE_NRECORDS ? tb->tb_next : TRACE_NRECORDS;
+	*first = (tb->tb_next - n) % TRACE_NRECORDS;
+	return n;
+}
+
+int
+trace_dump(const char *path)
+{
+	struct trace_header th;
+	struct tracebuf *tb;
+	struct vnode *vn;
+	char *pathcopy;
+	off_t pos;
+	unsigned i, first, n, chunk;
+	int result;
+
+	lock_acquire(&trace_lock);
+	trace_quiesce();
+
+	th.th_magic = TRACE_MAGIC;
+	th.th_version = TRACE_VERSION;
+	th.th_ncpus = ntracebufs;
+	th.th_recsize = sizeof(struct trace_record);
+	th.th_nrecords = 0;
+	for (i=0; i<ntracebufs; i++) {
+		th.th_nrecords += trace_count(&tracebufs[i], &first);
+	}
+
+	/* vfs_open may scribble on the path. */
+	pathcopy = kstrdup(path);
+	if (pathcopy == NULL) {
+		lock_release(&trace_lock);
+		return ENOMEM;
+	}
+	result = vfs_open(pathcopy, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	kfree(pathcopy);
+	if (result) {
+		lock_release(&trace_lock);
+		return result;
+	}
+
+	pos = 0;
+	result = trace_write(vn, &pos, &th, sizeof(th));
+	for (i=0; i<ntracebufs && result == 0; i++) {
+		tb = &tracebufs[i];
+		n = trace_count(tb, &first);
+
+		/* From the oldest to the end of the ring, then the rest. */
+		chunk = n < TRACE_NRECORDS - first ? n : TRACE_NRECORDS - first;
+		result = trace_write(vn, &pos, &tb->tb_recs[first],
+				     chunk * sizeof(struct trace_record));
+		if (result == 0 && n > chunk) {
+			result = trace_write(vn, &pos, &tb->tb_recs[0],
+					     (n - chunk) *
+					     sizeof(struct trace_record));
+		}
+	}
+
+	vfs_close(vn);
+	lock_release(&trace_lock);
+	if (result == 0) {
+		kprintf("trace: %u events written to %s\n",
+			th.th_nrecords, path);
+	}
+	return result;
+}
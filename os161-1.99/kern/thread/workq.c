@@ -0,0 +1,234 @@
+/*
+ * Deferred work: per-cpu soft work and worker thread queues. See
+ * <workq.h>.
+ *
+ * Soft work lives on a list in the cpu structure, which only that cpu
+ * touches, and only with interrupts off. mips_trap calls softwork_run
+ * after the interrupt handlers are done, if it's going back to a
+ * thread that was at IPL-low; it runs the work with interrupts back
+ * on, so further interrupts (which may add more work) aren't held
+ * off. While that's happening c_softrunning is set, which keeps a
+ * nested interrupt from starting the list again underneath us and
+ * keeps hardclock from switching threads on us. The idle loop also
+ * drains the list, with interrupts left off, so work queued by the
+ * interrupt that woke an idle cpu isn't left waiting for the next
+ * one.
+ *
+ * Worker queues are a list and a wait channel behind a spinlock, in
+ * the same way as a semaphore.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <workq.h>
+
+struct workqueue {
+	char *wq_name;
+	struct spinlock wq_lock;	/* protects the list */
+	struct wchan wq_wchan;		/* idle workers sleep here */
+	struct work *wq_head;
+	struct work **wq_tail;
+};
+
+struct workqueue *sys_workqueue;
+
+void
+work_init(struct work *w, void (*func)(void *), void *arg)
+{
+	w->w_next = NULL;
+	w->w_func = func;
+	w->w_arg = arg;
+	spinlock_data_set(&w->w_queued, 0);
+}
+
+/*
+ * Claim a work item for queueing. Returns false if it's already
+ * queued somewhere.
+ */
+static
+bool
+work_claim(struct work *w)
+{
+	return spinlock_data_testandset(&w->w_queued) == 0;
+}
+
+/*
+ * Unqueue a work item (it's been taken off its list) and run it.
+ */
+static
+void
+work_run(struct work *w)
+{
+	w->w_next = NULL;
+	spinlock_data_set(&w->w_queued, 0);
+	w->w_func(w->w_arg);
+}
+
+////////////////////////////////////////////////////////////
+// Soft work
+
+bool
+softwork_schedule(struct work *w)
+{
+	struct cpu *c;
+	int s;
+
+	if (!work_claim(w)) {
+		return false;
+	}
+
+	s = splhigh();
+	c = curcpu->c_self;
+	w->w_next = NULL;
+	*c->c_softtail = w;
+	c->c_softtail = &w->w_next;
+	splx(s);
+	return true;
+}
+
+/*
+ * Run this cpu's soft work, including anything queued while we're at
+ * it. Called with interrupts off (at IPL_HIGH) and returns that way;
+ * if LOWERSPL is set, interrupts go back on while the work runs.
+ */
+void
+softwork_run(bool lowerspl)
+{
+	struct cpu *c;
+	struct work *w;
+	int old_in;
+
+	KASSERT(curthread->t_curspl == IPL_HIGH);
+
+	c = curcpu->c_self;
+	if (c->c_softrunning || c->c_softwork == NULL) {
+		return;
+	}
+	c->c_softrunning = true;
+
+	old_in = curthread->t_in_interrupt;
+	curthread->t_in_interrupt = 1;
+
+	while ((w = c->c_softwork) != NULL) {
+		c->c_softwork = w->w_next;
+		if (c->c_softwork == NULL) {
+			c->c_softtail = &c->c_softwork;
+		}
+		if (lowerspl) {
+			spl0();
+			work_run(w);
+			splhigh();
+		}
+		else {
+			work_run(w);
+		}
+	}
+
+	curthread->t_in_interrupt = old_in;
+	c->c_softrunning = false;
+}
+
+////////////////////////////////////////////////////////////
+// Worker threads
+
+static
+void
+workqueue_thread(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct work *w;
+
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&wq->wq_lock);
+		while (wq->wq_head == NULL) {
+			wchan_lock(&wq->wq_wchan);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(&wq->wq_wchan);
+			spinlock_acquire(&wq->wq_lock);
+		}
+		w = wq->wq_head;
+		wq->wq_head = w->w_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tail = &wq->wq_head;
+		}
+		spinlock_release(&wq->wq_lock);
+
+		work_run(w);
+	}
+}
+
+/*
+ * Create a queue with NTHREADS worker threads, which run only on the
+ * CPUs in AFFINITY. The threads never exit, so neither does the
+ * queue.
+ */
+struct workqueue *
+workqueue_create(const char *name, unsigned nthreads, uint32_t affinity)
+{
+	struct workqueue *wq;
+	unsigned i;
+	int result;
+
+	KASSERT(nthreads > 0);
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	wq->wq_name = kstrdup(name);
+	if (wq->wq_name == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	spinlock_init(&wq->wq_lock);
+	wchan_init(&wq->wq_wchan, wq->wq_name);
+	wq->wq_head = NULL;
+	wq->wq_tail = &wq->wq_head;
+
+	for (i = 0; i < nthreads; i++) {
+		result = thread_fork_affinity(wq->wq_name, kproc,
+					      workqueue_thread, wq, 0,
+					      affinity);
+		if (result) {
+			panic("workqueue_create: %s: thread_fork: %s\n",
+			      name, strerror(result));
+		}
+	}
+
+	return wq;
+}
+
+bool
+workqueue_enqueue(struct workqueue *wq, struct work *w)
+{
+	if (!work_claim(w)) {
+		return false;
+	}
+
+	w->w_next = NULL;
+	spinlock_acquire(&wq->wq_lock);
+	*wq->wq_tail = w;
+	wq->wq_tail = &w->w_next;
+	wchan_wakeone(&wq->wq_wchan);
+	spinlock_release(&wq->wq_lock);
+	return true;
+}
+
+void
+workq_bootstrap(void)
+{
+	sys_workqueue = workqueue_create("sys_workqueue",
+					 SYS_WORKQUEUE_NTHREADS, CPUMASK_ALL);
+	if (sys_workqueue == NULL) {
+		panic("workq_bootstrap: Out of memory\n");
+	}
+}
@@ -0,0 +1,563 @@
+/*
+ * Pipes. See <pipe.h>.
+ *
+ * The buffer is a ring indexed by two free-running counters: p_head
+ * counts bytes ever written and p_tail bytes ever read, so the pipe
+ * holds p_head - p_tail bytes and the next byte in or out lives at
+ * the counter masked by PIPE_SIZE - 1. Only the writer moves p_head
+ * and only the reader moves p_tail, so with one of each the ring
+ * itself needs no lock: data goes in (or out) first, then a barrier,
+ * then the counter, and the other side reads the counter before the
+ * data. p_rlock and p_wlock make sure there is only one of each,
+ * taken once per read or write rather than per byte; holding p_wlock
+ * for a whole write also keeps writes of up to PIPE_BUF from being
+ * interleaved.
+ *
+ * A side that has to wait says so in p_rsleeping or p_wsleeping,
+ * with the wait channel locked, and then looks at the counters again
+ * before sleeping; the other side moves its counter and then checks
+ * the flag. With a barrier between on both sides, at least one of
+ * them sees the other, so no wakeup is lost. To keep the two sides
+ * from waking each other for every few bytes, the writer only wakes
+ * a sleeping reader once the pipe is half full (or at the end of the
+ * write), and the reader only wakes a sleeping writer once the pipe
+ * is half empty.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <stat.h>
+#include <lib.h>
+#include <atomic.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <pipe.h>
+
+#define PIPE_MASK	(PIPE_SIZE - 1)
+
+struct pipe {
+	char *p_buf;			/* PIPE_SIZE bytes */
+	volatile unsigned p_head;	/* bytes written; writer only */
+	volatile unsigned p_tail;	/* bytes read; reader only */
+
+	struct lock *p_rlock;		/* one reader at a time */
+	struct lock *p_wlock;		/* one writer at a time */
+
+	struct wchan p_rwchan;		/* reader waiting for data */
+	struct wchan p_wwchan;		/* writer waiting for room */
+	volatile bool p_rsleeping;	/* someone on p_rwchan */
+	volatile bool p_wsleeping;	/* someone on p_wwchan */
+
+	volatile bool p_rclosed;	/* read end closed */
+	volatile bool p_wclosed;	/* write end closed */
+
+	struct spinlock p_lock;		/* protects p_nends */
+	unsigned p_nends;		/* ends not yet reclaimed */
+
+	struct vnode p_rvn;		/* read end */
+	struct vnode p_wvn;		/* write end */
+};
+
+static const struct vnode_ops pipe_vnode_ops;
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	wchan_cleanup(&p->p_wwchan);
+	wchan_cleanup(&p->p_rwchan);
+	lock_destroy(p->p_wlock);
+	lock_destroy(p->p_rlock);
+	spinlock_cleanup(&p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+}
+
+static
+bool
+pipe_readable(struct pipe *p)
+{
+	return p->p_head != p->p_tail || p->p_wclosed;
+}
+
+static
+bool
+pipe_writable(struct pipe *p)
+{
+	return p->p_head - p->p_tail < PIPE_SIZE || p->p_rclosed;
+}
+
+/*
+ * Sleep on WC until READY says to go on, flagging that we're there
+ * in *SLEEPING. Returns straight away if READY already holds once
+ * the flag is up. Wakeups can be early, so callers check again.
+ */
+static
+void
+pipe_sleep(struct pipe *p, struct wchan *wc, volatile bool *sleeping,
+	   bool (*ready)(struct pipe *))
+{
+	wchan_lock(wc);
+	*sleeping = true;
+	atomic_membar();
+	if (ready(p)) {
+		*sleeping = false;
+		wchan_unlock(wc);
+		return;
+	}
+	wchan_sleep(wc);
+}
+
+/*
+ * Wake whoever is sleeping on WC, if anyone. The caller has already
+ * moved its counter (or set its closed flag).
+ */
+static
+void
+pipe_wake(struct wchan *wc, volatile bool *sleeping)
+{
+	atomic_membar();
+	if (*sleeping) {
+		*sleeping = false;
+		wchan_wakeall(wc);
+	}
+}
+
+/*
+ * Neither end can be opened by name, so this isn't reached.
+ */
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+/*
+ * Last close of an end: tell the other side, which may be waiting
+ * for it.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	if (v == &p->p_rvn) {
+		p->p_rclosed = true;
+		pipe_wake(&p->p_wwchan, &p->p_wsleeping);
+	}
+	else {
+		p->p_wclosed = true;
+		pipe_wake(&p->p_rwchan, &p->p_rsleeping);
+	}
+	return 0;
+}
+
+/*
+ * Last reference to an end. The pipe goes when both ends have.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	VOP_CLEANUP(v);
+
+	spinlock_acquire(&p->p_lock);
+	KASSERT(p->p_nends > 0);
+	p->p_nends--;
+	last = p->p_nends == 0;
+	spinlock_release(&p->p_lock);
+
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * Read whatever is there, up to what was asked for. Only wait if
+ * there's nothing at all; an empty pipe with its write end closed
+ * is EOF.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail, avail, off, n;
+	size_t startresid;
+	int result = 0;
+
+	if (v != &p->p_rvn) {
+		return EBADF;
+	}
+
+	startresid = uio->uio_resid;
+	lock_acquire(p->p_rlock);
+	while (uio->uio_resid > 0) {
+		tail = p->p_tail;
+		head = p->p_head;
+		avail = head - tail;
+		if (avail == 0) {
+			if (uio->uio_resid < startresid || p->p_wclosed) {
+				break;
+			}
+			pipe_sleep(p, &p->p_rwchan, &p->p_rsleeping,
+				   pipe_readable);
+			continue;
+		}
+
+		/* Don't look at the data until we've seen the head. */
+		atomic_membar();
+
+		/* As much as we can get without wrapping around. */
+		off = tail & PIPE_MASK;
+		n = avail;
+		if (n > PIPE_SIZE - off) {
+			n = PIPE_SIZE - off;
+		}
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, n, uio);
+		if (result) {
+			break;
+		}
+
+		/* Done with the data before the writer can have it back. */
+		atomic_membar();
+		p->p_tail = tail + n;
+
+		if (PIPE_SIZE - (avail - n) >= PIPE_SIZE / 2) {
+			pipe_wake(&p->p_wwchan, &p->p_wsleeping);
+		}
+	}
+	lock_release(p->p_rlock);
+
+	return result;
+}
+
+/*
+ * Write everything, waiting for room as needed. EPIPE if the read
+ * end is closed before anything could be written; if it closes
+ * partway, the write is cut short.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail, space, off, n;
+	size_t startresid;
+	int result = 0;
+
+	if (v != &p->p_wvn) {
+		return EBADF;
+	}
+
+	startresid = uio->uio_resid;
+	lock_acquire(p->p_wlock);
+	while (uio->uio_resid > 0) {
+		if (p->p_rclosed) {
+			if (uio->uio_resid == startresid) {
+				result = EPIPE;
+			}
+			break;
+		}
+
+		head = p->p_head;
+		tail = p->p_tail;
+		space = PIPE_SIZE - (head - tail);
+		if (space == 0) {
+			pipe_sleep(p, &p->p_wwchan, &p->p_wsleeping,
+				   pipe_writable);
+			continue;
+		}
+
+		/* Don't overwrite anything until we've seen the tail. */
+		atomic_membar();
+
+		off = head & PIPE_MASK;
+		n = space;
+		if (n > PIPE_SIZE - off) {
+			n = PIPE_SIZE - off;
+		}
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, n, uio);
+		if (result) {
+			break;
+		}
+
+		/* The data has to be there before the head says so. */
+		atomic_membar();
+		p->p_head = head + n;
+
+		if (PIPE_SIZE - (space - n) >= PIPE_SIZE / 2) {
+			pipe_wake(&p->p_rwchan, &p->p_rsleeping);
+		}
+	}
+
+	/* Whatever got written, the reader can have now. */
+	pipe_wake(&p->p_rwchan, &p->p_rsleeping);
+	lock_release(p->p_wlock);
+
+	return result;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_size = p->p_head - p->p_tail;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+/*
+ * Operations that are meaningless on pipes.
+ */
+
+static
+int
+pipe_badio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return EUNIMP;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *v, char *path, struct vnode **result)
+{
+	(void)v;
+	(void)path;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *v, char *path, struct vnode **result,
+		char *buf, size_t len)
+{
+	(void)v;
+	(void)path;
+	(void)result;
+	(void)buf;
+	(void)len;
+	return ENOTDIR;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_badio,      /* readlink */
+	pipe_badio,      /* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_badio,      /* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,     /* remove */
+	pipe_nameop,     /* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+int
+pipe_create(struct vnode **readret, struct vnode **writeret)
+{
+	struct pipe *p;
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	if (p->p_buf == NULL) {
+		goto fail;
+	}
+	p->p_rlock = lock_create("pipe read");
+	if (p->p_rlock == NULL) {
+		goto fail_buf;
+	}
+	p->p_wlock = lock_create("pipe write");
+	if (p->p_wlock == NULL) {
+		goto fail_rlock;
+	}
+
+	p->p_head = 0;
+	p->p_tail = 0;
+	wchan_init(&p->p_rwchan, "pipe read");
+	wchan_init(&p->p_wwchan, "pipe write");
+	p->p_rsleeping = false;
+	p->p_wsleeping = false;
+	p->p_rclosed = false;
+	p->p_wclosed = false;
+	spinlock_init(&p->p_lock);
+	p->p_nends = 2;
+
+	/* Pipes don't live on any filesystem, like devices. */
+	VOP_INIT(&p->p_rvn, &pipe_vnode_ops, NULL, p);
+	VOP_INIT(&p->p_wvn, &pipe_vnode_ops, NULL, p);
+	VOP_INCOPEN(&p->p_rvn);
+	VOP_INCOPEN(&p->p_wvn);
+
+	*readret = &p->p_rvn;
+	*writeret = &p->p_wvn;
+	return 0;
+
+ fail_rlock:
+	lock_destroy(p->p_rlock);
+ fail_buf:
+	kfree(p->p_buf);
+ fail:
+	kfree(p);
+	return ENOMEM;
+}
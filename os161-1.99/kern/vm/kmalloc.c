@@ -193,9 +193,12 @@ static struct pageref *allbase;
  * logic per-cpu is worthwhile for scalability; however, for the time
  * being at least we won't, because it adds a lot of complexity and in
  * OS/161 performance and scalability aren't super-critical.
+ *
+ * It's a ticket lock, so CPUs queued up on it are served in order.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock kmalloc_spinlock =
+	SPINLOCK_TICKET_INITIALIZER("kmalloc_spinlock");
 
 ////////////////////////////////////////
 
@@ -152,42 +152,27 @@ dowait(pid_t pid)
 }
 
 #ifdef WNOHANG
-/*
- * dowaitpoll
- * like dowait, but uses WNOHANG. returns true if we got something.
- */
-static
-int
-dowaitpoll(pid_t pid)
-{
-	int status;
-	pid_t result;
-	result = waitpid(pid, &status, WNOHANG);
-	if (result<0) {
-		warn("pid %d", pid);
-	}
-	else if (result!=0) {
-		printf("pid %d: ", pid);
-		printstatus(status);
-		printf("\n");
-		return 1;
-	}
-	return 0;
-}
-
 /*
  * waitpoll
- * poll all background jobs for having exited.
+ * reap whichever background jobs have exited, without waiting for the
+ * rest. waitpid(-1) hands them over one at a time until there are no
+ * more, so this doesn't have to ask about every job.
  */
 static
 void
 waitpoll(void)
 {
-	int i;
-	for (i=0; i < MAXBG; i++) {
-		if (bgpids[i] != 0) {
-			if (dowaitpoll(bgpids[i])) {
+	int i, status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		printf("pid %d: ", pid);
+		printstatus(status);
+		printf("\n");
+		for (i = 0; i < MAXBG; i++) {
+			if (bgpids[i] == pid) {
 				bgpids[i] = 0;
+				break;
 			}
 		}
 	}
@@ -354,11 +339,15 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
+	/*
+	 * The child does nothing but exec (or complain and exit), so
+	 * it can borrow our address space instead of copying it.
+	 */
+	pid = vfork();
 	switch (pid) {
 		case -1:
 			/* error */
-			warn("fork");
+			warn("vfork");
 			return _MKWAIT_EXIT(255);
 		case 0:
 			/* child */
@@ -0,0 +1,67 @@
+/*
+ * affinity.c
+ *
+ * Exercise setaffinity() and getaffinity(): pin ourselves to each
+ * CPU in turn, do some work there, and check that bad masks are
+ * refused.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define WORK 100000
+
+static
+void
+busywork(void)
+{
+	volatile unsigned i;
+
+	for (i=0; i<WORK; i++);
+}
+
+int
+main(void)
+{
+	unsigned all, mask;
+	unsigned cpu, ncpus;
+
+	if (getaffinity(&all) < 0) {
+		err(1, "getaffinity");
+	}
+	printf("Starting mask: 0x%x\n", all);
+
+	ncpus = 0;
+	for (cpu=0; cpu<32; cpu++) {
+		if ((all & (1U << cpu)) == 0) {
+			continue;
+		}
+		ncpus++;
+		if (setaffinity(1U << cpu) < 0) {
+			err(1, "setaffinity to cpu %u", cpu);
+		}
+		busywork();
+		if (getaffinity(&mask) < 0) {
+			err(1, "getaffinity");
+		}
+		if (mask != (1U << cpu)) {
+			errx(1, "Pinned to cpu %u but mask is 0x%x", cpu, mask);
+		}
+	}
+	printf("Ran pinned on each of %u cpus\n", ncpus);
+
+	if (setaffinity(0) >= 0) {
+		errx(1, "setaffinity(0) succeeded");
+	}
+	if (errno != EINVAL) {
+		err(1, "setaffinity(0) failed, but not with EINVAL");
+	}
+
+	if (setaffinity(all) < 0) {
+		err(1, "setaffinity to restore mask");
+	}
+	printf("Passed.\n");
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * argbench.c
+ *
+ * Time execv with a large argument list: exec ourselves ITERS times
+ * with NARGS arguments of ARGLEN characters each. The child checks
+ * it got them all intact and exits.
+ *
+ * Usage: argbench [nargs [arglen [iters]]]
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PROGPATH "/testbin/argbench"
+#define CHILDFLAG "-child"
+
+#define DEFAULT_NARGS	100
+#define DEFAULT_ARGLEN	100
+#define DEFAULT_ITERS	20
+
+/* The character argument I is made of. */
+static
+char
+argchar(int i)
+{
+	return 'a' + i % 26;
+}
+
+static
+int
+child(int argc, char **argv)
+{
+	int i, j, arglen;
+
+	arglen = argc > 2 ? strlen(argv[2]) : 0;
+	for (i=2; i<argc; i++) {
+		if ((int)strlen(argv[i]) != arglen) {
+			return 1;
+		}
+		for (j=0; j<arglen; j++) {
+			if (argv[i][j] != argchar(i - 2)) {
+				return 1;
+			}
+		}
+	}
+	return argv[argc] == NULL ? 0 : 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	int nargs, arglen, iters, i, status;
+	char **args;
+	pid_t pid;
+	time_t s0, s1;
+	unsigned long ns0, ns1, usecs;
+
+	if (argc > 1 && !strcmp(argv[1], CHILDFLAG)) {
+		return child(argc, argv);
+	}
+
+	nargs = argc > 1 ? atoi(argv[1]) : DEFAULT_NARGS;
+	arglen = argc > 2 ? atoi(argv[2]) : DEFAULT_ARGLEN;
+	iters = argc > 3 ? atoi(argv[3]) : DEFAULT_ITERS;
+	if (nargs < 0 || arglen < 1 || iters < 1) {
+		errx(1, "Usage: argbench [nargs [arglen [iters]]]");
+	}
+
+	args = malloc((nargs + 3) * sizeof(char *));
+	if (args == NULL) {
+		errx(1, "malloc");
+	}
+	args[0] = (char *)PROGPATH;
+	args[1] = (char *)CHILDFLAG;
+	for (i=0; i<nargs; i++) {
+		args[i+2] = malloc(arglen + 1);
+		if (args[i+2] == NULL) {
+			errx(1, "malloc");
+		}
+		memset(args[i+2], argchar(i), arglen);
+		args[i+2][arglen] = 0;
+	}
+	args[nargs+2] = NULL;
+
+	__time(&s0, &ns0);
+	for (i=0; i<iters; i++) {
+		pid = vfork();
+		if (pid < 0) {
+			err(1, "vfork");
+		}
+		if (pid == 0) {
+			execv(PROGPATH, args);
+			_exit(255);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "Child %d got bad arguments (status %d)",
+			     i, status);
+		}
+	}
+	__time(&s1, &ns1);
+
+	usecs = (s1 - s0) * 1000000 + ns1 / 1000 - ns0 / 1000;
+	printf("%d execs with %d args of %d bytes: %lu us each\n",
+	       iters, nargs, arglen, usecs / iters);
+	return 0;
+}
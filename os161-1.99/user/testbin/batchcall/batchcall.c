@@ -0,0 +1,128 @@
+/*
+ * batchcall.c
+ *
+ * Compare making N small system calls one at a time with making them
+ * as one sysbatch: first getpid, then one-byte writes to null:.
+ * Also checks that the batched calls return what the plain ones do,
+ * and that a call that can't be batched fails on its own.
+ *
+ * Usage: batchcall [n]
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <kern/syscall.h>
+
+#define DEFAULT_N	SYSBATCH_MAX
+
+static struct sysbatch ents[SYSBATCH_MAX];
+
+static time_t s0;
+static unsigned long ns0;
+
+static
+void
+start(void)
+{
+	__time(&s0, &ns0);
+}
+
+/* Microseconds per call since start(). */
+static
+unsigned long
+stop(int n)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return ((s1 - s0) * 1000000 + ns1 / 1000 - ns0 / 1000) / n;
+}
+
+int
+main(int argc, char **argv)
+{
+	int n, i, fd, r;
+	unsigned long plain, batched;
+	char c = 'x';
+	pid_t pid;
+
+	n = argc > 1 ? atoi(argv[1]) : DEFAULT_N;
+	if (n < 1 || n > SYSBATCH_MAX) {
+		errx(1, "Usage: batchcall [n], n at most %d", SYSBATCH_MAX);
+	}
+
+	pid = getpid();
+	start();
+	for (i=0; i<n; i++) {
+		getpid();
+	}
+	plain = stop(n);
+
+	for (i=0; i<n; i++) {
+		ents[i].sb_callno = SYS_getpid;
+	}
+	start();
+	r = sysbatch(ents, n);
+	batched = stop(n);
+	if (r != n) {
+		err(1, "sysbatch: got %d", r);
+	}
+	for (i=0; i<n; i++) {
+		if (ents[i].sb_err != 0 || ents[i].sb_retval != pid) {
+			errx(1, "getpid entry %d: %d (error %d)", i,
+			     ents[i].sb_retval, ents[i].sb_err);
+		}
+	}
+	printf("getpid: %lu us plain, %lu us batched\n", plain, batched);
+
+	fd = open("null:", O_WRONLY);
+	if (fd < 0) {
+		err(1, "null:");
+	}
+	start();
+	for (i=0; i<n; i++) {
+		write(fd, &c, 1);
+	}
+	plain = stop(n);
+
+	for (i=0; i<n; i++) {
+		ents[i].sb_callno = SYS_write;
+		ents[i].sb_args[0] = fd;
+		ents[i].sb_args[1] = (int)&c;
+		ents[i].sb_args[2] = 1;
+	}
+	start();
+	r = sysbatch(ents, n);
+	batched = stop(n);
+	if (r != n) {
+		err(1, "sysbatch: got %d", r);
+	}
+	for (i=0; i<n; i++) {
+		if (ents[i].sb_err != 0 || ents[i].sb_retval != 1) {
+			errx(1, "write entry %d: %d (error %d)", i,
+			     ents[i].sb_retval, ents[i].sb_err);
+		}
+	}
+	printf("write: %lu us plain, %lu us batched\n", plain, batched);
+	close(fd);
+
+	/* The fork in the middle fails; the others still run. */
+	ents[0].sb_callno = SYS_getpid;
+	ents[1].sb_callno = SYS_fork;
+	ents[2].sb_callno = SYS_getpid;
+	r = sysbatch(ents, 3);
+	if (r != 3) {
+		err(1, "sysbatch: got %d", r);
+	}
+	if (ents[0].sb_retval != pid || ents[2].sb_retval != pid ||
+	    ents[1].sb_err != EINVAL) {
+		errx(1, "Unbatchable call not handled right");
+	}
+
+	printf("batchcall: passed\n");
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * pipebench.c
+ *
+ * Measure pipe throughput between two processes: the child writes
+ * MEGS megabytes into a pipe CHUNK bytes at a time, and the parent
+ * reads it all back out, checking the data as it goes.
+ *
+ * Usage: pipebench [megs [chunk]]
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define DEFAULT_MEGS	4
+#define DEFAULT_CHUNK	4096
+#define MAXCHUNK	65536
+
+static char buf[MAXCHUNK];
+
+/* The byte at position POS in the stream. */
+static
+char
+streamchar(unsigned long pos)
+{
+	return 'a' + pos % 26;
+}
+
+static
+void
+writer(int fd, unsigned long total, int chunk)
+{
+	unsigned long pos;
+	int i, n, r;
+
+	pos = 0;
+	while (pos < total) {
+		n = chunk;
+		if ((unsigned long)n > total - pos) {
+			n = total - pos;
+		}
+		for (i=0; i<n; i++) {
+			buf[i] = streamchar(pos + i);
+		}
+		r = write(fd, buf, n);
+		if (r < 0) {
+			err(1, "write");
+		}
+		pos += r;
+	}
+}
+
+static
+unsigned long
+reader(int fd, int chunk)
+{
+	unsigned long pos;
+	int i, r;
+
+	pos = 0;
+	while ((r = read(fd, buf, chunk)) > 0) {
+		for (i=0; i<r; i++) {
+			if (buf[i] != streamchar(pos + i)) {
+				errx(1, "Bad data at byte %lu", pos + i);
+			}
+		}
+		pos += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	return pos;
+}
+
+int
+main(int argc, char **argv)
+{
+	int megs, chunk, status;
+	int fds[2];
+	unsigned long total, got, msecs, kbps;
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	pid_t pid;
+
+	megs = argc > 1 ? atoi(argv[1]) : DEFAULT_MEGS;
+	chunk = argc > 2 ? atoi(argv[2]) : DEFAULT_CHUNK;
+	if (megs < 1 || chunk < 1 || chunk > MAXCHUNK) {
+		errx(1, "Usage: pipebench [megs [chunk]]");
+	}
+	total = (unsigned long)megs * 1024 * 1024;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	__time(&s0, &ns0);
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		writer(fds[1], total, chunk);
+		close(fds[1]);
+		_exit(0);
+	}
+	close(fds[1]);
+	got = reader(fds[0], chunk);
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	__time(&s1, &ns1);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "Writer failed (status %d)", status);
+	}
+	if (got != total) {
+		errx(1, "Read %lu bytes, expected %lu", got, total);
+	}
+
+	msecs = (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	kbps = (total / 1024) * 1000 / msecs;
+	printf("%d MB in %d-byte chunks: %lu ms, %lu.%02lu MB/s\n",
+	       megs, chunk, msecs, kbps / 1024, (kbps % 1024) * 100 / 1024);
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * vecio.c
+ *
+ * Exercise writev(), readv(), pwrite(), and pread(): write a file in
+ * pieces with one writev, read it back scattered with one readv,
+ * patch it in the middle with pwrite, and check that pread sees the
+ * patch without moving the seek position.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#define FILENAME "vecio.tmp"
+#define NPIECES 4
+#define PIECELEN 16
+
+int
+main(void)
+{
+	char out[NPIECES][PIECELEN], in[NPIECES][PIECELEN];
+	struct iovec iov[NPIECES];
+	char buf[PIECELEN];
+	int fd, i, r;
+	off_t pos;
+
+	for (i=0; i<NPIECES; i++) {
+		memset(out[i], 'a' + i, PIECELEN);
+		iov[i].iov_base = out[i];
+		iov[i].iov_len = PIECELEN;
+	}
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+
+	r = writev(fd, iov, NPIECES);
+	if (r < 0) {
+		err(1, "writev");
+	}
+	if (r != NPIECES * PIECELEN) {
+		errx(1, "writev: short count %d", r);
+	}
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	for (i=0; i<NPIECES; i++) {
+		iov[i].iov_base = in[i];
+	}
+	r = readv(fd, iov, NPIECES);
+	if (r != NPIECES * PIECELEN) {
+		err(1, "readv: got %d", r);
+	}
+	if (memcmp(in, out, sizeof(out))) {
+		errx(1, "readv: data mismatch");
+	}
+
+	/* Overwrite piece 1 without moving the offset. */
+	memset(buf, 'z', PIECELEN);
+	if (pwrite(fd, buf, PIECELEN, PIECELEN) != PIECELEN) {
+		err(1, "pwrite");
+	}
+	memset(buf, 0, PIECELEN);
+	if (pread(fd, buf, PIECELEN, PIECELEN) != PIECELEN) {
+		err(1, "pread");
+	}
+	for (i=0; i<PIECELEN; i++) {
+		if (buf[i] != 'z') {
+			errx(1, "pread: data mismatch");
+		}
+	}
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != NPIECES * PIECELEN) {
+		errx(1, "pread/pwrite moved the offset to %ld", (long)pos);
+	}
+
+	close(fd);
+	remove(FILENAME);
+	printf("vecio: passed\n");
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * waitany.c
+ *
+ * Exercise waitpid with WNOHANG and with pid -1: a child blocked on
+ * a pipe shouldn't be reported until it exits, and NKIDS children
+ * should each be reaped exactly once, with the right status, by
+ * waitpid(-1), after which there are no children left.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NKIDS 8
+
+int
+main(void)
+{
+	pid_t pids[NKIDS], pid;
+	int reaped[NKIDS];
+	int fds[2];
+	int i, status, found;
+	char c;
+
+	/* A child that can't exit until we close the pipe. */
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[1]);
+		read(fds[0], &c, 1);
+		_exit(0);
+	}
+	close(fds[0]);
+	if (waitpid(pid, &status, WNOHANG) != 0) {
+		errx(1, "WNOHANG reported a running child");
+	}
+	if (waitpid(-1, &status, WNOHANG) != 0) {
+		errx(1, "WNOHANG reported a running child for pid -1");
+	}
+	close(fds[1]);
+	if (waitpid(-1, &status, 0) != pid) {
+		err(1, "waitpid(-1) for the blocked child");
+	}
+
+	for (i=0; i<NKIDS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			_exit(i);
+		}
+		reaped[i] = 0;
+	}
+	for (found=0; found<NKIDS; found++) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			err(1, "waitpid(-1)");
+		}
+		for (i=0; i<NKIDS && pids[i] != pid; i++) {
+			;
+		}
+		if (i == NKIDS || reaped[i]) {
+			errx(1, "waitpid(-1) returned unexpected pid %d", pid);
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != i) {
+			errx(1, "pid %d: wrong status %d", pid, status);
+		}
+		reaped[i] = 1;
+	}
+
+	if (waitpid(-1, &status, 0) >= 0 || errno != ECHILD) {
+		errx(1, "waitpid(-1) with no children didn't fail with ECHILD");
+	}
+
+	printf("waitany: passed\n");
+	return 0;
+}
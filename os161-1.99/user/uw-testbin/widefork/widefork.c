@@ -13,6 +13,10 @@
  *
  *  Example of correct output:  PAPBPCabc
  *
+ *  "widefork N" is a benchmark instead: the parent forks N children,
+ *  which exit at once, then waits for them all in birth order, and
+ *  prints how long the forks and the waits took.
+ *
  */
 #include <unistd.h>
 #include <stdlib.h>
@@ -21,6 +25,7 @@
 
 int dofork(int);
 void dowait(int,int);
+void widebench(int);
 
 int
 dofork(int childnum) 
@@ -59,12 +64,58 @@ dowait(int childpid, int childnum)
   }
 }
 
+static
+unsigned long
+elapsed_ms(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+  return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+void
+widebench(int n)
+{
+  pid_t *pids;
+  time_t s0, s1, s2;
+  unsigned long ns0, ns1, ns2;
+  int i, rval;
+
+  pids = malloc(n * sizeof(pid_t));
+  if (pids == NULL) {
+    errx(1,"malloc");
+  }
+
+  __time(&s0, &ns0);
+  for (i = 0; i < n; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      err(1,"fork %d",i);
+    }
+    else if (pids[i] == 0) {
+      _exit(0);
+    }
+  }
+  __time(&s1, &ns1);
+  for (i = 0; i < n; i++) {
+    if (waitpid(pids[i],&rval,0) < 0) {
+      err(1,"waitpid %d",i);
+    }
+  }
+  __time(&s2, &ns2);
+
+  printf("%d children: fork %lu ms, waitpid %lu ms\n", n,
+	 elapsed_ms(s0, ns0, s1, ns1), elapsed_ms(s1, ns1, s2, ns2));
+  free(pids);
+}
+
 int
 main(int argc, char *argv[])
 {
-  (void)argc;
-  (void)argv;
   pid_t pid1,pid2,pid3;
+
+  if (argc > 1) {
+    widebench(atoi(argv[1]));
+    return(0);
+  }
   putchar('P');
   putchar('\n');
   pid1 = dofork(1);